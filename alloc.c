@@ -0,0 +1,92 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "alloc.h"
+
+/* glibc's own entry points, which the wrappers below forward to */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+
+static _Thread_local bool tracking;
+static _Thread_local uint64_t count;
+
+void *malloc(size_t size) {
+	count += tracking;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	count += tracking;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	count += tracking;
+	return __libc_realloc(ptr, size);
+}
+
+/* The aligned variants all end up in __libc_memalign; the checks are the
+ * ones glibc makes before getting there */
+void *memalign(size_t alignment, size_t size) {
+	count += tracking;
+	return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+	count += tracking;
+	if (alignment == 0 || (alignment & (alignment - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+	count += tracking;
+	if (alignment % sizeof(void *) || (alignment & (alignment - 1))
+			|| alignment == 0) {
+		return EINVAL;
+	}
+	void *ptr = __libc_memalign(alignment, size);
+	if (!ptr) {
+		return ENOMEM;
+	}
+	*memptr = ptr;
+	return 0;
+}
+
+void *valloc(size_t size) {
+	count += tracking;
+	return __libc_valloc(size);
+}
+
+void *pvalloc(size_t size) {
+	count += tracking;
+	return __libc_pvalloc(size);
+}
+
+void alloc_track_begin(void) {
+	count = 0;
+	tracking = true;
+}
+
+uint64_t alloc_track_end(void) {
+	tracking = false;
+	return count;
+}
+
+/* For calls into libraries whose allocations are not ours to count */
+bool alloc_track_suspend(void) {
+	const bool was_tracking = tracking;
+	tracking = false;
+	return was_tracking;
+}
+
+void alloc_track_resume(bool was_tracking) {
+	tracking = was_tracking;
+}
@@ -0,0 +1,34 @@
+#ifndef _WSK_ALLOC_H
+#define _WSK_ALLOC_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Heap allocation counting for the keystroke path, built with the alloc-stats
+ * option. Counts malloc, calloc, realloc, posix_memalign, aligned_alloc,
+ * memalign, valloc and pvalloc calls made by this thread between
+ * alloc_track_begin and alloc_track_end; everything else compiles away.
+ */
+#ifdef WSK_ALLOC_STATS
+void alloc_track_begin(void);
+uint64_t alloc_track_end(void);
+bool alloc_track_suspend(void);
+void alloc_track_resume(bool was_tracking);
+#else
+static inline void alloc_track_begin(void) {
+}
+
+static inline uint64_t alloc_track_end(void) {
+	return 0;
+}
+
+static inline bool alloc_track_suspend(void) {
+	return false;
+}
+
+static inline void alloc_track_resume(bool was_tracking) {
+	(void)was_tracking;
+}
+#endif
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * Publishes key events into the feed as fast as it can while a second thread
+ * follows through a read-only mapping, the way an external consumer does, and
+ * prints the event rate, the time from publish to read and the events lost.
+ *
+ * usage: wsk-bench-feed [events]
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "feed.h"
+
+static atomic_bool done;
+
+static uint32_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct reader_result {
+	struct wsk_feed_reader reader;
+	uint64_t events;
+	double latency_us, max_latency_us;
+};
+
+static void *follow(void *data) {
+	struct reader_result *result = data;
+	struct wsk_feed_key key;
+	for (;;) {
+		// Check for the end first so that nothing published is missed
+		const bool last = atomic_load(&done);
+		while (feed_reader_next(&result->reader, &key)) {
+			const double latency = (uint32_t)(now_us() - key.time);
+			result->latency_us += latency;
+			if (latency > result->max_latency_us) {
+				result->max_latency_us = latency;
+			}
+			++result->events;
+		}
+		if (last) {
+			return NULL;
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	const long events = argc > 1 ? atol(argv[1]) : 10000000;
+
+	struct wsk_feed feed = { 0 };
+	if (feed_init(&feed) != 0) {
+		return 1;
+	}
+	struct reader_result result = { 0 };
+	if (feed_reader_init(&result.reader, feed.ro_fd) != 0) {
+		fprintf(stderr, "Unable to map the feed read-only\n");
+		feed_finish(&feed);
+		return 1;
+	}
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, follow, &result) != 0) {
+		fprintf(stderr, "Unable to start the reader\n");
+		return 1;
+	}
+
+	struct wsk_feed_key key = {
+		.seat = 1,
+		.keysym = 'a',
+		.count = 1,
+	};
+	const uint32_t start = now_us();
+	for (long i = 0; i < events; ++i) {
+		key.time = now_us();
+		key.label[0] = 'a' + i % 26;
+		feed_publish(&feed, &key);
+	}
+	const double elapsed = (uint32_t)(now_us() - start) / 1e6;
+	atomic_store(&done, true);
+	pthread_join(thread, NULL);
+
+	printf("published %ld events in %.3f s (%.1f M/s)\n",
+			events, elapsed, events / elapsed / 1e6);
+	printf("read %llu, lost %llu\n",
+			(unsigned long long)result.events,
+			(unsigned long long)result.reader.lost);
+	if (result.events) {
+		printf("publish to read: %.2f us mean, %.0f us max\n",
+				result.latency_us / result.events, result.max_latency_us);
+	}
+	feed_reader_finish(&result.reader);
+	feed_finish(&feed);
+	return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copies a frame into a shm buffer the way wshowkeys does, as XRGB8888, and
+ * packs it as RGB888 for comparison, then prints the bytes each format
+ * uploads and the cost of a frame, for a few overlay sizes. The expand column
+ * is what a compositor without 24-bit textures pays to unpack RGB888 again.
+ *
+ * usage: wsk-bench-formats [rounds]
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wayland-client.h>
+#include "shm.h"
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* What buffer_write did for RGB888 before wshowkeys settled on XRGB8888;
+ * rows stay 4-byte aligned */
+static void pack_rgb888(struct pool_buffer *buffer, const unsigned char *src,
+		int src_stride) {
+	unsigned char *dst = buffer->data;
+	for (uint32_t y = 0; y < buffer->height; ++y) {
+		const unsigned char *from = src + y * src_stride;
+		unsigned char *to = dst + y * buffer->stride;
+		for (uint32_t x = 0; x < buffer->width; ++x) {
+			memcpy(to + x * 3, from + x * 4, 3);
+		}
+	}
+}
+
+static const char *format_name(uint32_t format) {
+	return format == WL_SHM_FORMAT_RGB888 ? "RGB888" : shm_format_name(format);
+}
+
+static void expand(const struct pool_buffer *buffer, uint32_t *out) {
+	for (uint32_t y = 0; y < buffer->height; ++y) {
+		const unsigned char *row =
+			(const unsigned char *)buffer->data + y * buffer->stride;
+		for (uint32_t x = 0; x < buffer->width; ++x) {
+			uint32_t pixel = 0;
+			memcpy(&pixel, row + x * 3, 3);
+			out[y * buffer->width + x] = pixel | 0xFF000000;
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	const int rounds = argc > 1 ? atoi(argv[1]) : 500;
+	// One and four lines of keys, at scale 1 and 2
+	static const uint32_t sizes[][2] = {
+		{ 600, 40 }, { 1800, 40 }, { 1800, 160 }, { 3600, 320 },
+	};
+	static const uint32_t formats[] = {
+		WL_SHM_FORMAT_XRGB8888, WL_SHM_FORMAT_RGB888,
+	};
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		const uint32_t width = sizes[i][0], height = sizes[i][1];
+		uint32_t *image = malloc(width * height * sizeof(uint32_t));
+		uint32_t *unpacked = malloc(width * height * sizeof(uint32_t));
+		assert(image && unpacked);
+		for (uint32_t p = 0; p < width * height; ++p) {
+			image[p] = 0xFF000000 | (uint32_t)rand();
+		}
+
+		for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+			struct pool_buffer buffer = {
+				.width = width,
+				.height = height,
+				.format = formats[f],
+				.stride = formats[f] == WL_SHM_FORMAT_RGB888 ?
+					(width * 3 + 3) & ~3u : width * 4,
+			};
+			buffer.size = buffer.stride * height;
+			buffer.data = malloc(buffer.size);
+			assert(buffer.data);
+
+			double start = now_us();
+			for (int round = 0; round < rounds; ++round) {
+				if (formats[f] == WL_SHM_FORMAT_RGB888) {
+					pack_rgb888(&buffer, (const unsigned char *)image,
+							width * sizeof(uint32_t));
+				} else {
+					buffer_write(&buffer, (const unsigned char *)image,
+							width * sizeof(uint32_t), width, height);
+				}
+			}
+			const double write_us = (now_us() - start) / rounds;
+			double expand_us = 0;
+			if (formats[f] == WL_SHM_FORMAT_RGB888) {
+				start = now_us();
+				for (int round = 0; round < rounds; ++round) {
+					expand(&buffer, unpacked);
+				}
+				expand_us = (now_us() - start) / rounds;
+			}
+
+			printf("%4ux%-4u %-8s %8zu bytes  %8.1f us write  "
+					"%8.1f us expand  %6.2f GB/s\n", width, height,
+					format_name(formats[f]), buffer.size, write_us,
+					expand_us, buffer.size / (write_us * 1e3));
+			free(buffer.data);
+		}
+		free(image);
+		free(unpacked);
+	}
+	return 0;
+}
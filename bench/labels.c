@@ -0,0 +1,113 @@
+/*
+ * Draws label tiles the way wshowkeys does, once through Pango and once from
+ * the glyph cache, and prints the cost of a tile on each path for every
+ * quality profile, along with what drawing every label the first time costs.
+ *
+ * usage: wsk-bench-labels [font] [rounds]
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "glyphs.h"
+#include "image.h"
+#include "pango.h"
+
+static const char *const symbols[] = {
+	"⇧", "⌃", "⌥", "⌘", "⏎", "⌫", "⌦", "⇥", "␣", "⎋", "↑", "↓", "←", "→",
+	"⇞", "⇟", "⇱", "⇲", "⇪", "⎙", "…", " x", " ", "F12", "Ctrl+Shift+T",
+};
+
+static char labels[128][8];
+static size_t nlabels;
+
+static double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double run(PangoLayout *layout, struct wsk_glyph_cache *glyphs,
+		int height, int baseline, int rounds, struct wsk_image *tile) {
+	const double start = now_ms();
+	for (int round = 0; round < rounds; ++round) {
+		for (size_t i = 0; i < nlabels; ++i) {
+			const char *text = labels[i];
+			if (!glyphs || !glyph_cache_render(glyphs, text, height,
+						baseline, 0xFFFFFFFF, 0x000000CC, tile)) {
+				render_label_tile(layout, text, height, baseline,
+						0xFFFFFFFF, 0x000000CC, tile);
+			}
+		}
+		for (size_t i = 0; i < sizeof(symbols) / sizeof(symbols[0]); ++i) {
+			if (!glyphs || !glyph_cache_render(glyphs, symbols[i], height,
+						baseline, 0xAAAAAAFF, 0x000000CC, tile)) {
+				render_label_tile(layout, symbols[i], height, baseline,
+						0xAAAAAAFF, 0x000000CC, tile);
+			}
+		}
+	}
+	return now_ms() - start;
+}
+
+int main(int argc, char *argv[]) {
+	const char *spec = argc > 1 ? argv[1] : "monospace 24";
+	const int rounds = argc > 2 ? atoi(argv[2]) : 200;
+
+	struct wsk_font font = { 0 };
+	if (font_init(&font, spec) != 0) {
+		return 1;
+	}
+	for (char c = '!'; c <= '~'; ++c) {
+		labels[nlabels++][0] = c;
+	}
+	GString *corpus = g_string_new(NULL);
+	for (size_t i = 0; i < nlabels; ++i) {
+		g_string_append(corpus, labels[i]);
+	}
+	for (size_t i = 0; i < sizeof(symbols) / sizeof(symbols[0]); ++i) {
+		g_string_append(corpus, symbols[i]);
+	}
+
+	const size_t nall = nlabels + sizeof(symbols) / sizeof(symbols[0]);
+	const size_t tiles = rounds * nall;
+	printf("%s, %zu tiles per path\n", spec, tiles);
+	for (enum wsk_quality quality = WSK_QUALITY_FAST;
+			quality <= WSK_QUALITY_BEST; ++quality) {
+		cairo_font_options_t *fo = create_font_options(quality,
+				CAIRO_SUBPIXEL_ORDER_RGB);
+		PangoLayout *layout = create_label_layout(&font, 1, fo);
+		cairo_font_options_destroy(fo);
+		int height, baseline;
+		label_line_metrics(layout, corpus->str, &height, &baseline);
+		struct wsk_glyph_cache glyphs;
+		glyph_cache_init(&glyphs, layout);
+
+		// The first round on each path fills Pango's and our caches
+		struct wsk_image tile = { 0 };
+		const double cold_ms = run(layout, NULL, height, baseline, 1, &tile);
+		const double fill_ms = run(layout, &glyphs, height, baseline, 1, &tile);
+		const uint64_t fallbacks = glyphs.fallbacks;
+
+		const double pango_ms = run(layout, NULL, height, baseline,
+				rounds, &tile);
+		const double glyphs_ms = run(layout, &glyphs, height, baseline,
+				rounds, &tile);
+		printf("%s: %d px lines, first draw %.2f ms, glyph cache fill "
+				"%.2f ms\n", quality_name(quality), height, cold_ms, fill_ms);
+		printf("  Pango:       %8.2f us per tile\n", pango_ms * 1e3 / tiles);
+		printf("  glyph cache: %8.2f us per tile (%llu of %zu labels fall "
+				"back to Pango, %zu glyphs cached)\n",
+				glyphs_ms * 1e3 / tiles, (unsigned long long)fallbacks,
+				nall, glyphs.count);
+
+		image_finish(&tile);
+		glyph_cache_finish(&glyphs);
+		g_object_unref(layout);
+	}
+	g_string_free(corpus, TRUE);
+	font_finish(&font);
+	return 0;
+}
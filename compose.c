@@ -0,0 +1,110 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <xkbcommon/xkbcommon.h>
+#include <xkbcommon/xkbcommon-compose.h>
+#include "compose.h"
+
+/* XKB_KEY_dead_grave up to XKB_KEY_dead_longsolidusoverlay, which older
+ * headers do not name */
+#define WSK_DEAD_LAST 0xfe93
+
+static bool starts_sequence(xkb_keysym_t keysym) {
+	return (keysym >= XKB_KEY_dead_grave && keysym <= WSK_DEAD_LAST)
+		|| keysym == XKB_KEY_Multi_key;
+}
+
+static const char *compose_locale(void) {
+	static const char *const vars[] = { "LC_ALL", "LC_CTYPE", "LANG" };
+	for (size_t i = 0; i < sizeof(vars) / sizeof(vars[0]); ++i) {
+		const char *locale = getenv(vars[i]);
+		if (locale && *locale) {
+			return locale;
+		}
+	}
+	return "C";
+}
+
+static bool load_table(struct wsk_compose_table *table,
+		struct xkb_context *context) {
+	if (table->table || table->failed) {
+		return table->table;
+	}
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	const char *locale = compose_locale();
+	table->table = xkb_compose_table_new_from_locale(context, locale,
+			XKB_COMPOSE_COMPILE_NO_FLAGS);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	table->load_ms = (end.tv_sec - start.tv_sec) * 1e3
+		+ (end.tv_nsec - start.tv_nsec) / 1e6;
+	if (!table->table) {
+		// Dead keys keep showing by name
+		fprintf(stderr, "No compose table for locale %s\n", locale);
+		table->failed = true;
+		return false;
+	}
+	fprintf(stdout, "Loaded the compose table for %s in %.2f ms\n",
+			locale, table->load_ms);
+	return true;
+}
+
+enum wsk_compose_result compose_feed(struct wsk_compose *compose,
+		struct wsk_compose_table *table, struct xkb_context *context,
+		xkb_keysym_t keysym, char *utf8, size_t size) {
+	if (!compose->state) {
+		if (!starts_sequence(keysym) || table->failed) {
+			return WSK_COMPOSE_PASS;
+		}
+		++compose->warmups;
+		if (!load_table(table, context)) {
+			return WSK_COMPOSE_PASS;
+		}
+		compose->state = xkb_compose_state_new(table->table,
+				XKB_COMPOSE_STATE_NO_FLAGS);
+		if (!compose->state) {
+			return WSK_COMPOSE_PASS;
+		}
+	}
+
+	if (xkb_compose_state_feed(compose->state, keysym)
+			== XKB_COMPOSE_FEED_IGNORED) {
+		return WSK_COMPOSE_PASS;
+	}
+	int len;
+	switch (xkb_compose_state_get_status(compose->state)) {
+	case XKB_COMPOSE_COMPOSING:
+		return WSK_COMPOSE_PENDING;
+	case XKB_COMPOSE_COMPOSED:
+		len = xkb_compose_state_get_utf8(compose->state, utf8, size);
+		xkb_compose_state_reset(compose->state);
+		++compose->composed;
+		return len > 0 ? WSK_COMPOSE_DONE : WSK_COMPOSE_PASS;
+	case XKB_COMPOSE_CANCELLED:
+		// The key that broke the sequence is still shown
+		xkb_compose_state_reset(compose->state);
+		++compose->cancelled;
+		return WSK_COMPOSE_PASS;
+	case XKB_COMPOSE_NOTHING:
+		break;
+	}
+	return WSK_COMPOSE_PASS;
+}
+
+/* Chords and focus changes abandon a sequence in progress */
+void compose_reset(struct wsk_compose *compose) {
+	if (compose->state) {
+		xkb_compose_state_reset(compose->state);
+	}
+}
+
+void compose_finish(struct wsk_compose *compose) {
+	xkb_compose_state_unref(compose->state);
+	compose->state = NULL;
+}
+
+void compose_table_finish(struct wsk_compose_table *table) {
+	xkb_compose_table_unref(table->table);
+	table->table = NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef _WSK_COMPOSE_H
+#define _WSK_COMPOSE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+#include <xkbcommon/xkbcommon-compose.h>
+
+/*
+ * The locale's compose table, parsed the first time a dead key or Compose
+ * is pressed and kept for the session. Until then, and for anyone who never
+ * presses one, compose costs nothing.
+ */
+struct wsk_compose_table {
+	struct xkb_compose_table *table;
+	bool failed;
+	double load_ms;
+};
+
+/* One seat's position in a sequence; feeding it does not allocate */
+struct wsk_compose {
+	struct xkb_compose_state *state;
+	uint64_t composed, cancelled;
+	// Table loads and state creation, for the allocation accounting
+	uint64_t warmups;
+};
+
+enum wsk_compose_result {
+	WSK_COMPOSE_PASS, // not part of a sequence: show the key itself
+	WSK_COMPOSE_PENDING, // swallowed into the sequence
+	WSK_COMPOSE_DONE, // the sequence produced the UTF-8 in the buffer
+};
+
+enum wsk_compose_result compose_feed(struct wsk_compose *compose,
+		struct wsk_compose_table *table, struct xkb_context *context,
+		xkb_keysym_t keysym, char *utf8, size_t size);
+void compose_reset(struct wsk_compose *compose);
+void compose_finish(struct wsk_compose *compose);
+void compose_table_finish(struct wsk_compose_table *table);
+
+#endif
@@ -0,0 +1,951 @@
+/*
+ * Just enough of a Wayland compositor to run wshowkeys without a display:
+ * one output, one seat with a keyboard, wl_shm, layer shell, xdg-output and
+ * presentation time. Layer surfaces are configured the way wlroots does it,
+ * buffers are copied out and released as soon as they are committed, and
+ * frame callbacks and presentation feedback follow a fixed refresh clock.
+ * Every surface prints what it saw when it goes away.
+ *
+ * usage: wsk-fake-compositor [-o WxH] [-s scale] [-r Hz] [-p subpixel]
+ *            [-S socket] [-v] [command...]
+ *
+ * With a command, it runs with WAYLAND_DISPLAY pointing here and the
+ * compositor exits with it.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server.h>
+#include <xkbcommon/xkbcommon.h>
+#include "presentation-time-server-protocol.h"
+#include "wlr-layer-shell-unstable-v1-server-protocol.h"
+#include "xdg-output-unstable-v1-server-protocol.h"
+
+struct fake_server {
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct wl_event_source *tick;
+	int width, height, scale;
+	int refresh_mhz;
+	enum wl_output_subpixel subpixel;
+	bool verbose;
+	// With -c: whether any layer surface misbehaved or showed nothing
+	bool check, failed;
+
+	int keymap_fd;
+	uint32_t keymap_size;
+
+	uint64_t period_ns, next_ns, seq;
+	struct wl_list outputs; // wl_output resources
+	struct wl_list surfaces; // fake_surface::link
+	uint32_t nsurfaces;
+
+	pid_t child;
+	int status;
+};
+
+struct fake_surface {
+	struct fake_server *server;
+	struct wl_resource *resource;
+	struct wl_list link;
+	uint32_t id;
+
+	// Double-buffered wl_surface state
+	struct wl_resource *pending_buffer;
+	struct wl_listener buffer_destroy;
+	bool attached;
+	int32_t pending_scale, scale;
+	struct wl_list pending_frames, frames; // wl_callback resources
+	struct wl_list pending_feedback, feedback; // wp_presentation_feedback
+	bool mapped, entered;
+
+	// The copy a real compositor would upload
+	uint8_t *texture;
+	size_t texture_size;
+
+	struct wl_resource *layer;
+	uint32_t requested_width, requested_height, anchor;
+	uint32_t width, height, serial;
+	bool configured, acked;
+
+	struct {
+		uint32_t commits, buffers, released, configures;
+		uint32_t frames, presented, discarded;
+		uint32_t early, mismatched;
+		uint64_t bytes;
+	} stats;
+};
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void resource_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void resource_unlink(struct wl_resource *resource) {
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
+/* Lets the resources in a list go away on their own later */
+static void unlink_resources(struct wl_list *list) {
+	struct wl_resource *resource, *tmp;
+	wl_resource_for_each_safe(resource, tmp, list) {
+		wl_list_remove(wl_resource_get_link(resource));
+		wl_list_init(wl_resource_get_link(resource));
+	}
+}
+
+static void discard_feedback(struct fake_surface *surface) {
+	struct wl_resource *feedback, *tmp;
+	wl_resource_for_each_safe(feedback, tmp, &surface->feedback) {
+		wp_presentation_feedback_send_discarded(feedback);
+		wl_resource_destroy(feedback);
+		++surface->stats.discarded;
+	}
+}
+
+static void set_pending_buffer(struct fake_surface *surface,
+		struct wl_resource *buffer) {
+	wl_list_remove(&surface->buffer_destroy.link);
+	wl_list_init(&surface->buffer_destroy.link);
+	surface->pending_buffer = buffer;
+	if (buffer) {
+		wl_resource_add_destroy_listener(buffer, &surface->buffer_destroy);
+	}
+}
+
+static void handle_buffer_destroy(struct wl_listener *listener, void *data) {
+	struct fake_surface *surface =
+		wl_container_of(listener, surface, buffer_destroy);
+	set_pending_buffer(surface, NULL);
+}
+
+/* Copies the buffer out like a texture upload and hands it straight back */
+static void consume_buffer(struct fake_surface *surface,
+		struct wl_resource *buffer) {
+	struct wl_shm_buffer *shm = wl_shm_buffer_get(buffer);
+	if (!shm) {
+		wl_resource_post_error(surface->resource, WL_DISPLAY_ERROR_INVALID_OBJECT,
+				"only wl_shm buffers are supported");
+		return;
+	}
+	const int32_t width = wl_shm_buffer_get_width(shm);
+	const int32_t height = wl_shm_buffer_get_height(shm);
+	const size_t size = (size_t)wl_shm_buffer_get_stride(shm) * height;
+	if (size > surface->texture_size) {
+		free(surface->texture);
+		surface->texture = malloc(size);
+		assert(surface->texture);
+		surface->texture_size = size;
+	}
+	wl_shm_buffer_begin_access(shm);
+	memcpy(surface->texture, wl_shm_buffer_get_data(shm), size);
+	wl_shm_buffer_end_access(shm);
+	surface->stats.bytes += size;
+	++surface->stats.buffers;
+
+	if (surface->layer && !surface->acked) {
+		++surface->stats.early;
+		fprintf(stderr, "surface %u: buffer committed before the "
+				"configure was acked\n", surface->id);
+	} else if (surface->layer && ((uint32_t)width
+				!= surface->width * surface->scale
+				|| (uint32_t)height != surface->height * surface->scale)) {
+		++surface->stats.mismatched;
+		fprintf(stderr, "surface %u: %dx%d buffer for a %ux%u@%d surface\n",
+				surface->id, width, height,
+				surface->width, surface->height, surface->scale);
+	}
+	if (surface->server->verbose) {
+		fprintf(stdout, "surface %u: %dx%d buffer, format 0x%08x\n",
+				surface->id, width, height, wl_shm_buffer_get_format(shm));
+	}
+	wl_buffer_send_release(buffer);
+	++surface->stats.released;
+}
+
+static void send_enter(struct fake_surface *surface) {
+	struct wl_client *client = wl_resource_get_client(surface->resource);
+	struct wl_resource *output;
+	wl_resource_for_each(output, &surface->server->outputs) {
+		if (wl_resource_get_client(output) == client) {
+			wl_surface_send_enter(surface->resource, output);
+		}
+	}
+	surface->entered = true;
+}
+
+/* A layer surface is configured on its first commit and again whenever
+ * it asks for a different size */
+static void layer_commit(struct fake_surface *surface) {
+	const struct fake_server *server = surface->server;
+	const uint32_t both_h = ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT
+		| ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT;
+	const uint32_t both_v = ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP
+		| ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM;
+	uint32_t width = surface->requested_width;
+	uint32_t height = surface->requested_height;
+	if (width == 0 && (surface->anchor & both_h) == both_h) {
+		width = server->width / server->scale;
+	}
+	if (height == 0 && (surface->anchor & both_v) == both_v) {
+		height = server->height / server->scale;
+	}
+	if (surface->configured
+			&& width == surface->width && height == surface->height) {
+		return;
+	}
+	surface->width = width;
+	surface->height = height;
+	surface->serial = wl_display_next_serial(server->display);
+	surface->configured = true;
+	surface->acked = false;
+	++surface->stats.configures;
+	zwlr_layer_surface_v1_send_configure(surface->layer,
+			surface->serial, width, height);
+}
+
+static void surface_attach(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *buffer,
+		int32_t x, int32_t y) {
+	struct fake_surface *surface = wl_resource_get_user_data(resource);
+	set_pending_buffer(surface, buffer);
+	surface->attached = true;
+}
+
+static void surface_damage(struct wl_client *client,
+		struct wl_resource *resource,
+		int32_t x, int32_t y, int32_t width, int32_t height) {
+	// Everything committed is copied anyway
+}
+
+static void surface_frame(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct fake_surface *surface = wl_resource_get_user_data(resource);
+	struct wl_resource *callback =
+		wl_resource_create(client, &wl_callback_interface, 1, id);
+	if (!callback) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(callback, NULL, NULL, resource_unlink);
+	wl_list_insert(surface->pending_frames.prev,
+			wl_resource_get_link(callback));
+}
+
+static void surface_set_region(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *region) {
+	// Nothing is blended or hit-tested here
+}
+
+static void surface_commit(struct wl_client *client,
+		struct wl_resource *resource) {
+	struct fake_surface *surface = wl_resource_get_user_data(resource);
+	++surface->stats.commits;
+	surface->scale = surface->pending_scale;
+	if (surface->attached) {
+		struct wl_resource *buffer = surface->pending_buffer;
+		surface->attached = false;
+		set_pending_buffer(surface, NULL);
+		if (buffer) {
+			consume_buffer(surface, buffer);
+			surface->mapped = true;
+		} else if (surface->mapped) {
+			// Unmapped: the next commit starts over with a configure
+			surface->mapped = false;
+			surface->configured = surface->acked = false;
+		}
+	}
+
+	wl_list_insert_list(surface->frames.prev, &surface->pending_frames);
+	wl_list_init(&surface->pending_frames);
+	// Whatever was not presented yet has been replaced
+	discard_feedback(surface);
+	wl_list_insert_list(&surface->feedback, &surface->pending_feedback);
+	wl_list_init(&surface->pending_feedback);
+
+	if (surface->layer) {
+		layer_commit(surface);
+	}
+	if (surface->mapped && !surface->entered) {
+		send_enter(surface);
+	}
+}
+
+static void surface_set_buffer_transform(struct wl_client *client,
+		struct wl_resource *resource, int32_t transform) {
+	// Always normal
+}
+
+static void surface_set_buffer_scale(struct wl_client *client,
+		struct wl_resource *resource, int32_t scale) {
+	struct fake_surface *surface = wl_resource_get_user_data(resource);
+	if (scale < 1) {
+		wl_resource_post_error(resource, WL_SURFACE_ERROR_INVALID_SCALE,
+				"scale %d is not positive", scale);
+		return;
+	}
+	surface->pending_scale = scale;
+}
+
+static const struct wl_surface_interface surface_impl = {
+	.destroy = resource_destroy,
+	.attach = surface_attach,
+	.damage = surface_damage,
+	.frame = surface_frame,
+	.set_opaque_region = surface_set_region,
+	.set_input_region = surface_set_region,
+	.commit = surface_commit,
+	.set_buffer_transform = surface_set_buffer_transform,
+	.set_buffer_scale = surface_set_buffer_scale,
+	.damage_buffer = surface_damage,
+};
+
+static void print_surface_stats(const struct fake_surface *surface) {
+	fprintf(stdout, "surface %u: %u commits, %u configures, "
+			"%u buffers (%u released, %.1f MiB read), "
+			"%u frame callbacks, %u presented, %u discarded",
+			surface->id, surface->stats.commits, surface->stats.configures,
+			surface->stats.buffers, surface->stats.released,
+			surface->stats.bytes / (1024.0 * 1024.0),
+			surface->stats.frames, surface->stats.presented,
+			surface->stats.discarded);
+	if (surface->stats.early || surface->stats.mismatched) {
+		fprintf(stdout, ", %u before configure, %u with the wrong size",
+				surface->stats.early, surface->stats.mismatched);
+	}
+	fprintf(stdout, "\n");
+
+	struct fake_server *server = surface->server;
+	if (!server->check || !surface->stats.configures) {
+		return;
+	}
+	if (!surface->stats.buffers) {
+		fprintf(stderr, "surface %u: no buffer was ever committed\n",
+				surface->id);
+		server->failed = true;
+	}
+	if (surface->stats.early || surface->stats.mismatched
+			|| surface->stats.released != surface->stats.buffers) {
+		server->failed = true;
+	}
+}
+
+static void surface_handle_destroy(struct wl_resource *resource) {
+	struct fake_surface *surface = wl_resource_get_user_data(resource);
+	print_surface_stats(surface);
+	set_pending_buffer(surface, NULL);
+	unlink_resources(&surface->pending_frames);
+	unlink_resources(&surface->frames);
+	unlink_resources(&surface->pending_feedback);
+	unlink_resources(&surface->feedback);
+	if (surface->layer) {
+		wl_resource_set_user_data(surface->layer, NULL);
+	}
+	wl_list_remove(&surface->link);
+	free(surface->texture);
+	free(surface);
+}
+
+static void compositor_create_surface(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct fake_server *server = wl_resource_get_user_data(resource);
+	struct fake_surface *surface = calloc(1, sizeof(struct fake_surface));
+	assert(surface);
+	surface->resource = wl_resource_create(client, &wl_surface_interface,
+			wl_resource_get_version(resource), id);
+	if (!surface->resource) {
+		free(surface);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	surface->server = server;
+	surface->id = ++server->nsurfaces;
+	surface->pending_scale = surface->scale = 1;
+	surface->buffer_destroy.notify = handle_buffer_destroy;
+	wl_list_init(&surface->buffer_destroy.link);
+	wl_list_init(&surface->pending_frames);
+	wl_list_init(&surface->frames);
+	wl_list_init(&surface->pending_feedback);
+	wl_list_init(&surface->feedback);
+	wl_list_insert(server->surfaces.prev, &surface->link);
+	wl_resource_set_implementation(surface->resource, &surface_impl,
+			surface, surface_handle_destroy);
+}
+
+static void region_add(struct wl_client *client, struct wl_resource *resource,
+		int32_t x, int32_t y, int32_t width, int32_t height) {
+	// Regions are accepted and ignored
+}
+
+static const struct wl_region_interface region_impl = {
+	.destroy = resource_destroy,
+	.add = region_add,
+	.subtract = region_add,
+};
+
+static void compositor_create_region(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct wl_resource *region = wl_resource_create(client,
+			&wl_region_interface, wl_resource_get_version(resource), id);
+	if (!region) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(region, &region_impl, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_impl = {
+	.create_surface = compositor_create_surface,
+	.create_region = compositor_create_region,
+};
+
+static void bind_compositor(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource =
+		wl_resource_create(client, &wl_compositor_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &compositor_impl, data, NULL);
+}
+
+static void layer_surface_set_size(struct wl_client *client,
+		struct wl_resource *resource, uint32_t width, uint32_t height) {
+	struct fake_surface *surface = wl_resource_get_user_data(resource);
+	if (surface) {
+		surface->requested_width = width;
+		surface->requested_height = height;
+	}
+}
+
+static void layer_surface_set_anchor(struct wl_client *client,
+		struct wl_resource *resource, uint32_t anchor) {
+	struct fake_surface *surface = wl_resource_get_user_data(resource);
+	if (surface) {
+		surface->anchor = anchor;
+	}
+}
+
+static void layer_surface_set_exclusive_zone(struct wl_client *client,
+		struct wl_resource *resource, int32_t zone) {
+	// Nothing to keep clear of
+}
+
+static void layer_surface_set_margin(struct wl_client *client,
+		struct wl_resource *resource,
+		int32_t top, int32_t right, int32_t bottom, int32_t left) {
+	// Placement does not matter without a screen
+}
+
+static void layer_surface_set_keyboard_interactivity(struct wl_client *client,
+		struct wl_resource *resource, uint32_t interactivity) {
+	// Focus never moves
+}
+
+static void layer_surface_get_popup(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *popup) {
+	// There is no xdg_wm_base to make popups with
+}
+
+static void layer_surface_ack_configure(struct wl_client *client,
+		struct wl_resource *resource, uint32_t serial) {
+	struct fake_surface *surface = wl_resource_get_user_data(resource);
+	if (surface && surface->configured && serial == surface->serial) {
+		surface->acked = true;
+	}
+}
+
+static const struct zwlr_layer_surface_v1_interface layer_surface_impl = {
+	.set_size = layer_surface_set_size,
+	.set_anchor = layer_surface_set_anchor,
+	.set_exclusive_zone = layer_surface_set_exclusive_zone,
+	.set_margin = layer_surface_set_margin,
+	.set_keyboard_interactivity = layer_surface_set_keyboard_interactivity,
+	.get_popup = layer_surface_get_popup,
+	.ack_configure = layer_surface_ack_configure,
+	.destroy = resource_destroy,
+};
+
+static void layer_surface_handle_destroy(struct wl_resource *resource) {
+	struct fake_surface *surface = wl_resource_get_user_data(resource);
+	if (surface) {
+		surface->layer = NULL;
+		surface->configured = surface->acked = false;
+	}
+}
+
+static void layer_shell_get_layer_surface(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource, struct wl_resource *output,
+		uint32_t layer, const char *namespace) {
+	struct fake_surface *surface = wl_resource_get_user_data(surface_resource);
+	if (surface->layer) {
+		wl_resource_post_error(resource,
+				ZWLR_LAYER_SHELL_V1_ERROR_ALREADY_CONSTRUCTED,
+				"surface %u already has a layer surface", surface->id);
+		return;
+	}
+	surface->layer = wl_resource_create(client,
+			&zwlr_layer_surface_v1_interface,
+			wl_resource_get_version(resource), id);
+	if (!surface->layer) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(surface->layer, &layer_surface_impl,
+			surface, layer_surface_handle_destroy);
+	if (surface->server->verbose) {
+		fprintf(stdout, "surface %u: layer surface \"%s\" on layer %u\n",
+				surface->id, namespace, layer);
+	}
+}
+
+static const struct zwlr_layer_shell_v1_interface layer_shell_impl = {
+	.get_layer_surface = layer_shell_get_layer_surface,
+};
+
+static void bind_layer_shell(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+			&zwlr_layer_shell_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &layer_shell_impl, data, NULL);
+}
+
+static const struct wl_keyboard_interface keyboard_impl = {
+	.release = resource_destroy,
+};
+
+static void seat_get_keyboard(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	const struct fake_server *server = wl_resource_get_user_data(resource);
+	struct wl_resource *keyboard = wl_resource_create(client,
+			&wl_keyboard_interface, wl_resource_get_version(resource), id);
+	if (!keyboard) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(keyboard, &keyboard_impl, NULL, NULL);
+	wl_keyboard_send_keymap(keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1,
+			server->keymap_fd, server->keymap_size);
+	if (wl_resource_get_version(keyboard)
+			>= WL_KEYBOARD_REPEAT_INFO_SINCE_VERSION) {
+		wl_keyboard_send_repeat_info(keyboard, 25, 600);
+	}
+}
+
+static void seat_get_device(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	// Only a keyboard is advertised
+}
+
+static const struct wl_seat_interface seat_impl = {
+	.get_pointer = seat_get_device,
+	.get_keyboard = seat_get_keyboard,
+	.get_touch = seat_get_device,
+	.release = resource_destroy,
+};
+
+static void bind_seat(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource =
+		wl_resource_create(client, &wl_seat_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &seat_impl, data, NULL);
+	wl_seat_send_capabilities(resource, WL_SEAT_CAPABILITY_KEYBOARD);
+	if (version >= WL_SEAT_NAME_SINCE_VERSION) {
+		wl_seat_send_name(resource, "seat0");
+	}
+}
+
+static const struct wl_output_interface output_impl = {
+	.release = resource_destroy,
+};
+
+static void bind_output(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct fake_server *server = data;
+	struct wl_resource *resource =
+		wl_resource_create(client, &wl_output_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &output_impl,
+			server, resource_unlink);
+	wl_list_insert(&server->outputs, wl_resource_get_link(resource));
+
+	// A 96 DPI panel
+	wl_output_send_geometry(resource, 0, 0,
+			server->width * 254 / 960, server->height * 254 / 960,
+			server->subpixel, "wshowkeys", "fake",
+			WL_OUTPUT_TRANSFORM_NORMAL);
+	wl_output_send_mode(resource,
+			WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED,
+			server->width, server->height, server->refresh_mhz);
+	if (version >= WL_OUTPUT_SCALE_SINCE_VERSION) {
+		wl_output_send_scale(resource, server->scale);
+	}
+	if (version >= WL_OUTPUT_DONE_SINCE_VERSION) {
+		wl_output_send_done(resource);
+	}
+}
+
+static const struct zxdg_output_v1_interface xdg_output_impl = {
+	.destroy = resource_destroy,
+};
+
+static void output_manager_get_xdg_output(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *output) {
+	const struct fake_server *server = wl_resource_get_user_data(resource);
+	struct wl_resource *xdg_output = wl_resource_create(client,
+			&zxdg_output_v1_interface, wl_resource_get_version(resource), id);
+	if (!xdg_output) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(xdg_output, &xdg_output_impl, NULL, NULL);
+	zxdg_output_v1_send_logical_position(xdg_output, 0, 0);
+	zxdg_output_v1_send_logical_size(xdg_output,
+			server->width / server->scale, server->height / server->scale);
+	if (wl_resource_get_version(xdg_output)
+			>= ZXDG_OUTPUT_V1_NAME_SINCE_VERSION) {
+		zxdg_output_v1_send_name(xdg_output, "FAKE-1");
+		zxdg_output_v1_send_description(xdg_output, "wsk-fake-compositor");
+	}
+	zxdg_output_v1_send_done(xdg_output);
+}
+
+static const struct zxdg_output_manager_v1_interface output_manager_impl = {
+	.destroy = resource_destroy,
+	.get_xdg_output = output_manager_get_xdg_output,
+};
+
+static void bind_output_manager(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+			&zxdg_output_manager_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &output_manager_impl,
+			data, NULL);
+}
+
+static void presentation_feedback(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *surface_resource,
+		uint32_t id) {
+	struct fake_surface *surface = wl_resource_get_user_data(surface_resource);
+	struct wl_resource *feedback = wl_resource_create(client,
+			&wp_presentation_feedback_interface,
+			wl_resource_get_version(resource), id);
+	if (!feedback) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(feedback, NULL, NULL, resource_unlink);
+	wl_list_insert(surface->pending_feedback.prev,
+			wl_resource_get_link(feedback));
+}
+
+static const struct wp_presentation_interface presentation_impl = {
+	.destroy = resource_destroy,
+	.feedback = presentation_feedback,
+};
+
+static void bind_presentation(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+			&wp_presentation_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &presentation_impl, data, NULL);
+	wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC);
+}
+
+static void present(struct fake_surface *surface, uint64_t vblank_ns) {
+	const uint64_t sec = vblank_ns / 1000000000;
+	const uint64_t seq = surface->server->seq;
+	struct wl_resource *feedback, *tmp;
+	wl_resource_for_each_safe(feedback, tmp, &surface->feedback) {
+		struct wl_client *client = wl_resource_get_client(feedback);
+		struct wl_resource *output;
+		wl_resource_for_each(output, &surface->server->outputs) {
+			if (wl_resource_get_client(output) == client) {
+				wp_presentation_feedback_send_sync_output(feedback, output);
+			}
+		}
+		wp_presentation_feedback_send_presented(feedback,
+				sec >> 32, sec & 0xFFFFFFFF, vblank_ns % 1000000000,
+				surface->server->period_ns, seq >> 32, seq & 0xFFFFFFFF,
+				WP_PRESENTATION_FEEDBACK_KIND_VSYNC);
+		wl_resource_destroy(feedback);
+		++surface->stats.presented;
+	}
+}
+
+/* One refresh: what was committed since the last one is now on screen */
+static int handle_tick(void *data) {
+	struct fake_server *server = data;
+	const uint64_t vblank_ns = server->next_ns;
+	++server->seq;
+
+	struct fake_surface *surface;
+	wl_list_for_each(surface, &server->surfaces, link) {
+		struct wl_resource *callback, *tmp;
+		wl_resource_for_each_safe(callback, tmp, &surface->frames) {
+			wl_callback_send_done(callback, vblank_ns / 1000000);
+			wl_resource_destroy(callback);
+			++surface->stats.frames;
+		}
+		present(surface, vblank_ns);
+	}
+
+	// Stay on the grid even when a tick comes late
+	const uint64_t now = now_ns();
+	do {
+		server->next_ns += server->period_ns;
+	} while (server->next_ns <= now);
+	const int delay = (server->next_ns - now + 999999) / 1000000;
+	wl_event_source_timer_update(server->tick, delay);
+	return 0;
+}
+
+static int handle_signal(int signal, void *data) {
+	struct fake_server *server = data;
+	if (signal == SIGCHLD) {
+		int status;
+		if (server->child <= 0
+				|| waitpid(server->child, &status, WNOHANG) != server->child) {
+			return 0;
+		}
+		server->status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+		server->child = 0;
+	}
+	wl_display_terminate(server->display);
+	return 0;
+}
+
+static int create_keymap(struct fake_server *server) {
+	struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+	struct xkb_keymap *keymap = context ? xkb_keymap_new_from_names(
+			context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS) : NULL;
+	char *text = keymap ?
+		xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1) : NULL;
+	xkb_keymap_unref(keymap);
+	xkb_context_unref(context);
+	if (!text) {
+		fprintf(stderr, "Unable to compile the default keymap\n");
+		return -1;
+	}
+	server->keymap_size = strlen(text) + 1;
+
+	char name[64];
+	snprintf(name, sizeof(name), "/wsk-fake-keymap-%ld", (long)getpid());
+	server->keymap_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (server->keymap_fd != -1) {
+		shm_unlink(name);
+	}
+	if (server->keymap_fd == -1
+			|| write(server->keymap_fd, text, server->keymap_size)
+				!= (ssize_t)server->keymap_size) {
+		fprintf(stderr, "Unable to share the keymap: %s\n", strerror(errno));
+		free(text);
+		return -1;
+	}
+	free(text);
+	return 0;
+}
+
+static pid_t spawn(const char *socket, char *argv[]) {
+	const pid_t pid = fork();
+	if (pid == 0) {
+		// The event loop blocks the signals it handles
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		setenv("WAYLAND_DISPLAY", socket, 1);
+		execvp(argv[0], argv);
+		fprintf(stderr, "Unable to run %s: %s\n", argv[0], strerror(errno));
+		_exit(127);
+	} else if (pid == -1) {
+		fprintf(stderr, "fork: %s\n", strerror(errno));
+	}
+	return pid;
+}
+
+static int parse_subpixel(const char *name) {
+	static const char *const names[] = {
+		[WL_OUTPUT_SUBPIXEL_UNKNOWN] = "unknown",
+		[WL_OUTPUT_SUBPIXEL_NONE] = "none",
+		[WL_OUTPUT_SUBPIXEL_HORIZONTAL_RGB] = "rgb",
+		[WL_OUTPUT_SUBPIXEL_HORIZONTAL_BGR] = "bgr",
+		[WL_OUTPUT_SUBPIXEL_VERTICAL_RGB] = "vrgb",
+		[WL_OUTPUT_SUBPIXEL_VERTICAL_BGR] = "vbgr",
+	};
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		if (strcmp(name, names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static const char usage[] =
+	"usage: wsk-fake-compositor [-o WxH] [-s scale] [-r Hz] [-p subpixel]\n"
+	"           [-S socket] [-c] [-v] [command...]\n"
+	"\n"
+	"  -o WxH       output mode (default 1920x1080)\n"
+	"  -s scale     output scale (default 1)\n"
+	"  -r Hz        refresh rate (default 60)\n"
+	"  -p subpixel  unknown, none, rgb, bgr, vrgb or vbgr (default unknown)\n"
+	"  -S socket    socket name (default: the first free wayland-N)\n"
+	"  -c           fail unless every layer surface got buffers, none before\n"
+	"               its configure or of the wrong size, and all released\n"
+	"  -v           log every layer surface and buffer\n";
+
+int main(int argc, char *argv[]) {
+	struct fake_server server = {
+		.width = 1920,
+		.height = 1080,
+		.scale = 1,
+		.refresh_mhz = 60000,
+		.subpixel = WL_OUTPUT_SUBPIXEL_UNKNOWN,
+		.keymap_fd = -1,
+	};
+	const char *socket = NULL;
+	int c, subpixel;
+	// Stop at the command so its options are left alone
+	while ((c = getopt(argc, argv, "+cho:p:r:s:S:v")) != -1) {
+		switch (c) {
+		case 'o':
+			if (sscanf(optarg, "%dx%d", &server.width, &server.height) != 2
+					|| server.width <= 0 || server.height <= 0) {
+				fprintf(stderr, "Invalid output mode %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			subpixel = parse_subpixel(optarg);
+			if (subpixel == -1) {
+				fprintf(stderr, "Invalid subpixel layout %s\n", optarg);
+				return 1;
+			}
+			server.subpixel = subpixel;
+			break;
+		case 'r':
+			server.refresh_mhz = (int)(strtod(optarg, NULL) * 1000);
+			if (server.refresh_mhz <= 0) {
+				fprintf(stderr, "Invalid refresh rate %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 's':
+			server.scale = atoi(optarg);
+			if (server.scale < 1) {
+				fprintf(stderr, "Invalid scale %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'S':
+			socket = optarg;
+			break;
+		case 'c':
+			server.check = true;
+			break;
+		case 'v':
+			server.verbose = true;
+			break;
+		default:
+			fprintf(stderr, "%s", usage);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (create_keymap(&server) != 0) {
+		return 1;
+	}
+	server.display = wl_display_create();
+	assert(server.display);
+	server.loop = wl_display_get_event_loop(server.display);
+	if (socket) {
+		if (wl_display_add_socket(server.display, socket) != 0) {
+			fprintf(stderr, "Unable to listen on %s\n", socket);
+			return 1;
+		}
+	} else if (!(socket = wl_display_add_socket_auto(server.display))) {
+		fprintf(stderr, "Unable to find a free socket\n");
+		return 1;
+	}
+
+	wl_list_init(&server.outputs);
+	wl_list_init(&server.surfaces);
+	wl_display_init_shm(server.display);
+	wl_display_add_shm_format(server.display, WL_SHM_FORMAT_RGB888);
+	wl_global_create(server.display, &wl_compositor_interface, 4,
+			&server, bind_compositor);
+	wl_global_create(server.display, &wl_seat_interface, 5,
+			&server, bind_seat);
+	wl_global_create(server.display, &wl_output_interface, 3,
+			&server, bind_output);
+	wl_global_create(server.display, &zxdg_output_manager_v1_interface, 2,
+			&server, bind_output_manager);
+	wl_global_create(server.display, &zwlr_layer_shell_v1_interface, 1,
+			&server, bind_layer_shell);
+	wl_global_create(server.display, &wp_presentation_interface, 1,
+			&server, bind_presentation);
+
+	wl_event_loop_add_signal(server.loop, SIGINT, handle_signal, &server);
+	wl_event_loop_add_signal(server.loop, SIGTERM, handle_signal, &server);
+	wl_event_loop_add_signal(server.loop, SIGCHLD, handle_signal, &server);
+	server.period_ns = 1000000000000ull / server.refresh_mhz;
+	server.next_ns = now_ns() + server.period_ns;
+	server.tick = wl_event_loop_add_timer(server.loop, handle_tick, &server);
+	wl_event_source_timer_update(server.tick, server.period_ns / 1000000);
+
+	fprintf(stdout, "Running on WAYLAND_DISPLAY=%s, %dx%d@%d.%03d Hz, "
+			"scale %d\n", socket, server.width, server.height,
+			server.refresh_mhz / 1000, server.refresh_mhz % 1000, server.scale);
+	fflush(stdout);
+	if (optind < argc) {
+		server.child = spawn(socket, &argv[optind]);
+		if (server.child == -1) {
+			return 1;
+		}
+	}
+
+	wl_display_run(server.display);
+
+	wl_display_destroy_clients(server.display);
+	wl_event_source_remove(server.tick);
+	wl_display_destroy(server.display);
+	close(server.keymap_fd);
+	return server.status ? server.status : server.failed;
+}
@@ -6,21 +6,28 @@
  */
 #ifdef __FreeBSD__
 #define __BSD_VISIBLE 1
+#else
+#define _GNU_SOURCE // SCHED_RESET_ON_FORK
 #endif
 #include <errno.h>
 #include <fcntl.h>
 #include <libinput.h>
 #include <libudev.h>
 #include <limits.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include "devmgr.h"
+#include "latency.h"
+#include "trace.h"
 
 enum msg_type {
 	MSG_OPEN,
@@ -123,7 +130,80 @@ static void devmgr_run(int sockfd, const char *devpath) {
 	exit(0);
 }
 
-int devmgr_start(int *fd, pid_t *pid, const char *devpath) {
+#ifndef SCHED_RESET_ON_FORK
+#define SCHED_RESET_ON_FORK 0
+#endif
+
+#define WSK_RTPRIO 10
+#define WSK_NICE -10
+// Fonts, glyph caches, tiles, two shm buffers per output and thread stacks
+#define WSK_MEMLOCK_MIN (64 << 20)
+#define WSK_MEMLOCK_MAX (256 << 20)
+
+static rlim_t soft_limit(int resource) {
+	struct rlimit limit;
+	return getrlimit(resource, &limit) == 0 ? limit.rlim_cur : 0;
+}
+
+/*
+ * Runs as root, but only takes what the real user could have taken: limits
+ * are inherited across the setuid exec, so RLIMIT_RTPRIO, RLIMIT_NICE and
+ * RLIMIT_MEMLOCK are the user's own (typically granted to a realtime or audio
+ * group by pam_limits). Low enough a priority that audio and the compositor
+ * still win, and not passed on to anything we start.
+ */
+static void acquire_low_latency(void) {
+	const rlim_t rtprio = soft_limit(RLIMIT_RTPRIO);
+	struct sched_param param = {
+		.sched_priority = rtprio < WSK_RTPRIO ? (int)rtprio : WSK_RTPRIO,
+	};
+	static const int policies[] = { SCHED_FIFO, SCHED_RR };
+	int policy = SCHED_OTHER;
+	for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0])
+			&& param.sched_priority > 0; ++i) {
+		if (sched_setscheduler(0,
+					policies[i] | SCHED_RESET_ON_FORK, &param) == 0) {
+			policy = policies[i];
+			break;
+		}
+	}
+	if (policy != SCHED_OTHER) {
+		fprintf(stdout, "Low latency: %s priority %d\n",
+				latency_policy_name(policy), param.sched_priority);
+		// The SIGUSR1 report reads it back the same way
+		if (latency_policy() != policy) {
+			fprintf(stderr, "Low latency: set %s but the scheduler reports "
+					"%s\n", latency_policy_name(policy),
+					latency_policy_name(latency_policy()));
+		}
+	} else if (soft_limit(RLIMIT_NICE) >= (rlim_t)(20 - WSK_NICE)
+			&& setpriority(PRIO_PROCESS, 0, WSK_NICE) == 0) {
+		fprintf(stdout, "Low latency: nice %d\n", WSK_NICE);
+	} else {
+		fprintf(stderr, "Low latency: RLIMIT_RTPRIO and RLIMIT_NICE do not "
+				"allow raising priority\n");
+	}
+
+	// MCL_FUTURE fails allocations past the limit, so only lock everything
+	// when the user's limit leaves room, and never more than we need
+	rlim_t memlock = soft_limit(RLIMIT_MEMLOCK);
+	if (memlock < WSK_MEMLOCK_MIN) {
+		fprintf(stderr, "Low latency: RLIMIT_MEMLOCK is below %d MiB, "
+				"locking shm buffers only\n", WSK_MEMLOCK_MIN >> 20);
+		return;
+	}
+	if (memlock > WSK_MEMLOCK_MAX) {
+		memlock = WSK_MEMLOCK_MAX;
+	}
+	const struct rlimit bounded = { memlock, memlock };
+	if (setrlimit(RLIMIT_MEMLOCK, &bounded) != 0
+			|| mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		fprintf(stderr, "Low latency: unable to lock memory: %s\n",
+				strerror(errno));
+	}
+}
+
+int devmgr_start(int *fd, pid_t *pid, const char *devpath, bool low_latency) {
 	if (geteuid() != 0) {
 		fprintf(stderr, "wshowkeys needs to be setuid to read input events\n");
 		return 1;
@@ -149,6 +229,11 @@ int devmgr_start(int *fd, pid_t *pid, const char *devpath) {
 	*fd = sock[0];
 	*pid = child;
 
+	// Only for this process; the device opener stays as it is
+	if (low_latency) {
+		acquire_low_latency();
+	}
+
 	if (setgid(getgid()) != 0) {
 		fprintf(stderr, "devmgr: setgid: %s\n", strerror(errno));
 		return 1;
@@ -168,6 +253,7 @@ int devmgr_start(int *fd, pid_t *pid, const char *devpath) {
 int devmgr_open(int sockfd, const char *path) {
 	struct msg msg = { .msg_type = MSG_OPEN };
 	snprintf(msg.path, sizeof(msg.path), "%s", path);
+	WSK_TRACE2(devmgr_open, trace_now(), path);
 
 	send_msg(sockfd, -1, &msg, sizeof(msg));
 
@@ -177,6 +263,7 @@ int devmgr_open(int sockfd, const char *path) {
 		ret = recv_msg(sockfd, &fd, &err, sizeof(err));
 	} while (ret == 0 && retry++ < 3);
 
+	WSK_TRACE3(devmgr_opened, trace_now(), path, err ? -err : fd);
 	return err ? -err : fd;
 }
 
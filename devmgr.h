@@ -1,7 +1,9 @@
 #ifndef _DEVMGR_H
 #define _DEVMGR_H
 
-int devmgr_start(int *fd, pid_t *pid, const char *devpath);
+#include <stdbool.h>
+
+int devmgr_start(int *fd, pid_t *pid, const char *devpath, bool low_latency);
 int devmgr_open(int sockfd, const char *path);
 void devmgr_finish(int sock, pid_t pid);
 
@@ -0,0 +1,221 @@
+#define _GNU_SOURCE // memfd_create and file seals
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "feed.h"
+
+static size_t ring_size(void) {
+	return sizeof(struct wsk_feed_header)
+		+ WSK_FEED_SLOTS * sizeof(struct wsk_feed_slot);
+}
+
+/* A read-write and a read-only descriptor of the same memfd, sealed at its
+ * size. Readers only ever get the second. */
+static int open_ring(size_t size, int *ro_fd) {
+	const int fd = memfd_create("wshowkeys-feed",
+			MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1) {
+		return -1;
+	}
+	int ret;
+	do {
+		ret = ftruncate(fd, size);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) == -1) {
+		close(fd);
+		return -1;
+	}
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	*ro_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (*ro_fd == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int feed_init(struct wsk_feed *feed) {
+	feed->size = ring_size();
+	feed->fd = open_ring(feed->size, &feed->ro_fd);
+	if (feed->fd == -1) {
+		fprintf(stderr, "Unable to create the event feed: %s\n",
+				strerror(errno));
+		return -1;
+	}
+	void *data = mmap(NULL, feed->size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, feed->fd, 0);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Unable to map the event feed: %s\n", strerror(errno));
+		close(feed->ro_fd);
+		close(feed->fd);
+		feed->fd = feed->ro_fd = -1;
+		return -1;
+	}
+#ifdef F_SEAL_FUTURE_WRITE
+	// Our mapping stays writable; nobody can map or write it that way again
+	// (Linux 5.1 and later)
+	fcntl(feed->fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE);
+#endif
+	fcntl(feed->fd, F_ADD_SEALS, F_SEAL_SEAL);
+	feed->header = data;
+	feed->slots = (struct wsk_feed_slot *)(feed->header + 1);
+	feed->header->magic = WSK_FEED_MAGIC;
+	feed->header->version = WSK_FEED_VERSION;
+	feed->header->slots = WSK_FEED_SLOTS;
+	feed->header->slot_size = sizeof(struct wsk_feed_slot);
+	atomic_store_explicit(&feed->header->head, 0, memory_order_release);
+	feed->seq = 0;
+	return 0;
+}
+
+void feed_publish(struct wsk_feed *feed, const struct wsk_feed_key *key) {
+	const uint64_t seq = ++feed->seq;
+	struct wsk_feed_slot *slot = &feed->slots[seq & (WSK_FEED_SLOTS - 1)];
+	// Invalidate the slot before its old event is overwritten
+	atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot->key = *key;
+	atomic_store_explicit(&slot->seq, seq, memory_order_release);
+	atomic_store_explicit(&feed->header->head, seq, memory_order_release);
+}
+
+void feed_finish(struct wsk_feed *feed) {
+	if (!feed->header) {
+		return;
+	}
+	munmap(feed->header, feed->size);
+	close(feed->ro_fd);
+	close(feed->fd);
+	memset(feed, 0, sizeof(*feed));
+}
+
+/* Asks a running wshowkeys for its feed; returns a read-only descriptor */
+int feed_connect(const char *socket_path) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, socket_path);
+	const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1) {
+		return -1;
+	}
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1
+			|| write(sock, "feed\n", 5) != 5) {
+		close(sock);
+		return -1;
+	}
+
+	// The descriptor comes with the "ok" line
+	int fd = -1;
+	char line[128];
+	size_t len = 0;
+	while (len < sizeof(line) && !memchr(line, '\n', len)) {
+		union {
+			struct cmsghdr header;
+			char buf[CMSG_SPACE(sizeof(int))];
+		} control;
+		struct iovec iov = { line + len, sizeof(line) - len };
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = control.buf,
+			.msg_controllen = sizeof(control.buf),
+		};
+		const ssize_t n = recvmsg(sock, &msg, 0);
+		if (n <= 0) {
+			break;
+		}
+		len += n;
+		const struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+				&& cmsg->cmsg_type == SCM_RIGHTS) {
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+		}
+	}
+	close(sock);
+	if (fd == -1 || len < 3 || strncmp(line, "ok\n", 3) != 0) {
+		if (fd != -1) {
+			close(fd);
+		}
+		errno = EPROTO;
+		return -1;
+	}
+	return fd;
+}
+
+int feed_reader_init(struct wsk_feed_reader *reader, int fd) {
+	memset(reader, 0, sizeof(*reader));
+	const size_t size = ring_size();
+	void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		return -1;
+	}
+	const struct wsk_feed_header *header = data;
+	if (header->magic != WSK_FEED_MAGIC
+			|| header->version != WSK_FEED_VERSION
+			|| header->slots != WSK_FEED_SLOTS
+			|| header->slot_size != sizeof(struct wsk_feed_slot)) {
+		munmap(data, size);
+		errno = EPROTO;
+		return -1;
+	}
+	reader->header = header;
+	reader->slots = (const struct wsk_feed_slot *)(header + 1);
+	reader->size = size;
+	// Start with the next event
+	reader->next = atomic_load_explicit(
+			(_Atomic uint64_t *)&header->head, memory_order_acquire) + 1;
+	return 0;
+}
+
+/* Copies out the next event, if there is one */
+bool feed_reader_next(struct wsk_feed_reader *reader, struct wsk_feed_key *key) {
+	for (;;) {
+		const uint64_t head = atomic_load_explicit(
+				(_Atomic uint64_t *)&reader->header->head,
+				memory_order_acquire);
+		if (reader->next > head) {
+			return false;
+		}
+		// Lapped by the writer
+		if (head - reader->next >= WSK_FEED_SLOTS) {
+			const uint64_t oldest = head - WSK_FEED_SLOTS + 1;
+			reader->lost += oldest - reader->next;
+			reader->next = oldest;
+		}
+
+		_Atomic uint64_t *seq = (_Atomic uint64_t *)&reader->slots[
+			reader->next & (WSK_FEED_SLOTS - 1)].seq;
+		if (atomic_load_explicit(seq, memory_order_acquire) == reader->next) {
+			*key = reader->slots[reader->next & (WSK_FEED_SLOTS - 1)].key;
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(seq, memory_order_relaxed)
+					== reader->next) {
+				++reader->next;
+				return true;
+			}
+		}
+		// Overwritten while we looked; the next pass skips ahead
+		++reader->lost;
+		++reader->next;
+	}
+}
+
+void feed_reader_finish(struct wsk_feed_reader *reader) {
+	if (reader->header) {
+		munmap((void *)reader->header, reader->size);
+	}
+	memset(reader, 0, sizeof(*reader));
+}
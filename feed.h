@@ -0,0 +1,72 @@
+#ifndef _WSK_FEED_H
+#define _WSK_FEED_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Processed key events in a shared memory ring with a single writer. Readers
+ * map it read-only and follow the writer without system calls. Every slot
+ * holds the sequence number of its event, stored after the event itself, so
+ * a reader can tell a complete event from one that is being overwritten.
+ */
+#define WSK_FEED_MAGIC 0x464B5357 /* "WSKF" */
+#define WSK_FEED_VERSION 1
+#define WSK_FEED_SLOTS 4096
+
+/* Replaces the previous event: the same key, counted once more */
+#define WSK_FEED_FOLDED (1 << 0)
+/* Shown in the special key color */
+#define WSK_FEED_SPECIAL (1 << 1)
+
+struct wsk_feed_key {
+	uint32_t time; // libinput timestamp, milliseconds
+	uint32_t seat; // wl_seat global name
+	uint32_t keysym;
+	uint16_t count;
+	uint8_t mods; // WSK_STATS_SHIFT, CTRL, ALT and SUPER bits
+	uint8_t flags;
+	char label[40]; // UTF-8, NUL-terminated
+};
+
+struct wsk_feed_slot {
+	_Atomic uint64_t seq;
+	struct wsk_feed_key key;
+};
+
+struct wsk_feed_header {
+	uint32_t magic, version;
+	uint32_t slots, slot_size;
+	// Sequence number of the newest event; the first is 1
+	_Atomic uint64_t head;
+	char reserved[40];
+};
+
+/* The writer, in wshowkeys */
+struct wsk_feed {
+	int fd, ro_fd;
+	struct wsk_feed_header *header;
+	struct wsk_feed_slot *slots;
+	size_t size;
+	uint64_t seq;
+};
+
+int feed_init(struct wsk_feed *feed);
+void feed_publish(struct wsk_feed *feed, const struct wsk_feed_key *key);
+void feed_finish(struct wsk_feed *feed);
+
+/* A consumer; events older than the ring are counted as lost */
+struct wsk_feed_reader {
+	const struct wsk_feed_header *header;
+	const struct wsk_feed_slot *slots;
+	size_t size;
+	uint64_t next, lost;
+};
+
+int feed_connect(const char *socket_path);
+int feed_reader_init(struct wsk_feed_reader *reader, int fd);
+bool feed_reader_next(struct wsk_feed_reader *reader, struct wsk_feed_key *key);
+void feed_reader_finish(struct wsk_feed_reader *reader);
+
+#endif
@@ -0,0 +1,278 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "glyphs.h"
+
+/* Longer labels are chords, which Pango draws well enough once */
+#define WSK_GLYPHS_MAX 32
+
+void glyph_cache_init(struct wsk_glyph_cache *cache, PangoLayout *layout) {
+	memset(cache, 0, sizeof(*cache));
+	PangoFont *font = pango_context_load_font(pango_layout_get_context(layout),
+			pango_layout_get_font_description(layout));
+	if (!font) {
+		return;
+	}
+	// The scaled font carries the size and the font options of the layout
+	cache->font = cairo_scaled_font_reference(
+			pango_cairo_font_get_scaled_font(PANGO_CAIRO_FONT(font)));
+	g_object_unref(font);
+	cairo_font_options_t *fo = cairo_font_options_create();
+	cairo_scaled_font_get_font_options(cache->font, fo);
+	cache->gray = cairo_font_options_get_antialias(fo) == CAIRO_ANTIALIAS_GRAY;
+	cairo_font_options_destroy(fo);
+}
+
+static const char *utf8_next(const char *text, uint32_t *cp) {
+	const unsigned char *p = (const unsigned char *)text;
+	size_t len;
+	if (p[0] < 0x80) {
+		*cp = p[0];
+		return text + 1;
+	} else if ((p[0] & 0xE0) == 0xC0) {
+		*cp = p[0] & 0x1F;
+		len = 2;
+	} else if ((p[0] & 0xF0) == 0xE0) {
+		*cp = p[0] & 0x0F;
+		len = 3;
+	} else if ((p[0] & 0xF8) == 0xF0) {
+		*cp = p[0] & 0x07;
+		len = 4;
+	} else {
+		return NULL;
+	}
+	for (size_t i = 1; i < len; ++i) {
+		if ((p[i] & 0xC0) != 0x80) {
+			return NULL;
+		}
+		*cp = *cp << 6 | (p[i] & 0x3F);
+	}
+	return text + len;
+}
+
+static bool simple_codepoint(uint32_t cp) {
+	// Latin, punctuation, arrows, technical symbols and control pictures.
+	// Combining marks (0x300-0x36F and the ones for symbols at
+	// 0x20D0-0x20FF), controls and scripts that need shaping go through
+	// Pango.
+	return (cp >= 0x20 && cp < 0x7F)
+		|| (cp >= 0xA0 && cp < 0x300)
+		|| (cp >= 0x2010 && cp <= 0x2027)
+		|| (cp >= 0x2030 && cp <= 0x205E)
+		|| (cp >= 0x20A0 && cp < 0x20D0)
+		|| (cp >= 0x2100 && cp < 0x2C00);
+}
+
+static void draw_glyph(struct wsk_glyph_cache *cache,
+		struct wsk_glyph *glyph, unsigned long index) {
+	cairo_glyph_t g = { .index = index };
+	cairo_text_extents_t ext;
+	cairo_scaled_font_glyph_extents(cache->font, &g, 1, &ext);
+	glyph->advance = (int)lround(ext.x_advance);
+	if (ext.width <= 0 || ext.height <= 0) {
+		image_resize(&glyph->mask, 0, 0);
+		return;
+	}
+
+	// A pixel of slack around the ink for antialiasing
+	glyph->left = (int)floor(ext.x_bearing) - 1;
+	glyph->top = (int)floor(ext.y_bearing) - 1;
+	const int right = (int)ceil(ext.x_bearing + ext.width) + 1;
+	const int bottom = (int)ceil(ext.y_bearing + ext.height) + 1;
+	image_resize(&glyph->mask, right - glyph->left, bottom - glyph->top);
+
+	// White on black in RGB24 keeps per-channel coverage for subpixel
+	// antialiasing
+	cairo_surface_t *surface = cairo_image_surface_create_for_data(
+			(unsigned char *)glyph->mask.pixels, CAIRO_FORMAT_RGB24,
+			glyph->mask.width, glyph->mask.height,
+			glyph->mask.stride * sizeof(uint32_t));
+	cairo_t *cairo = cairo_create(surface);
+	cairo_set_source_rgb(cairo, 0, 0, 0);
+	cairo_paint(cairo);
+	cairo_set_source_rgb(cairo, 1, 1, 1);
+	cairo_set_scaled_font(cairo, cache->font);
+	g.x = -glyph->left;
+	g.y = -glyph->top;
+	cairo_show_glyphs(cairo, &g, 1);
+	cairo_destroy(cairo);
+	cairo_surface_flush(surface);
+	cairo_surface_destroy(surface);
+}
+
+static void grow_glyphs(struct wsk_glyph_cache *cache) {
+	const size_t size = cache->glyphs ? (cache->mask + 1) * 2 : 64;
+	struct wsk_glyph *glyphs = calloc(size, sizeof(struct wsk_glyph));
+	assert(glyphs);
+	for (size_t i = 0; cache->glyphs && i <= cache->mask; ++i) {
+		if (!cache->glyphs[i].key) {
+			continue;
+		}
+		size_t slot = (cache->glyphs[i].key * 2654435761u) & (size - 1);
+		while (glyphs[slot].key) {
+			slot = (slot + 1) & (size - 1);
+		}
+		glyphs[slot] = cache->glyphs[i];
+	}
+	free(cache->glyphs);
+	cache->glyphs = glyphs;
+	cache->mask = size - 1;
+}
+
+static const struct wsk_glyph *get_glyph(struct wsk_glyph_cache *cache,
+		unsigned long index) {
+	if (!cache->glyphs || cache->count * 2 >= cache->mask + 1) {
+		grow_glyphs(cache);
+	}
+	const unsigned long key = index + 1;
+	size_t slot = (key * 2654435761u) & cache->mask;
+	for (; cache->glyphs[slot].key; slot = (slot + 1) & cache->mask) {
+		if (cache->glyphs[slot].key == key) {
+			++cache->hits;
+			return &cache->glyphs[slot];
+		}
+	}
+	++cache->misses;
+	++cache->count;
+	struct wsk_glyph *glyph = &cache->glyphs[slot];
+	glyph->key = key;
+	draw_glyph(cache, glyph, index);
+	cache->mask_bytes += image_memory(&glyph->mask);
+	return glyph;
+}
+
+static void flush_glyphs(struct wsk_glyph_cache *cache) {
+	// The table stays; the masks are drawn again as they are needed
+	for (size_t i = 0; i <= cache->mask; ++i) {
+		image_finish(&cache->glyphs[i].mask);
+		cache->glyphs[i].key = 0;
+	}
+	cache->count = 0;
+	cache->mask_bytes = 0;
+	++cache->flushes;
+}
+
+static inline uint32_t over(uint32_t dst, uint32_t alpha, uint32_t src) {
+	return (dst * (255 - alpha) + src * alpha + 127) / 255;
+}
+
+static void blend_glyph(struct wsk_image *tile, const struct wsk_glyph *glyph,
+		int x, int y, uint32_t fg, bool gray) {
+	const uint32_t fr = fg >> 24 & 0xFF, fgr = fg >> 16 & 0xFF;
+	const uint32_t fb = fg >> 8 & 0xFF, fa = fg & 0xFF;
+	for (uint32_t row = 0; row < glyph->mask.height; ++row) {
+		const int ty = y + (int)row;
+		if (ty < 0 || ty >= (int)tile->height) {
+			continue;
+		}
+		const uint32_t *src = glyph->mask.pixels
+			+ (size_t)row * glyph->mask.stride;
+		uint32_t *dst = tile->pixels + (size_t)ty * tile->stride;
+		for (uint32_t col = 0; col < glyph->mask.width; ++col) {
+			const int tx = x + (int)col;
+			if (tx < 0 || tx >= (int)tile->width || !(src[col] & 0xFFFFFF)) {
+				continue;
+			}
+			const uint32_t d = dst[tx];
+			if (gray) {
+				const uint32_t c = (src[col] & 0xFF) * fa / 255;
+				dst[tx] = over(d >> 24, c, 255) << 24
+					| over(d >> 16 & 0xFF, c, fr) << 16
+					| over(d >> 8 & 0xFF, c, fgr) << 8
+					| over(d & 0xFF, c, fb);
+				continue;
+			}
+			// Premultiplied OVER, one coverage value per channel
+			const uint32_t cr = (src[col] >> 16 & 0xFF) * fa / 255;
+			const uint32_t cg = (src[col] >> 8 & 0xFF) * fa / 255;
+			const uint32_t cb = (src[col] & 0xFF) * fa / 255;
+			uint32_t ca = cr > cg ? cr : cg;
+			ca = ca > cb ? ca : cb;
+			dst[tx] = over(d >> 24, ca, 255) << 24
+				| over(d >> 16 & 0xFF, cr, fr) << 16
+				| over(d >> 8 & 0xFF, cg, fgr) << 8
+				| over(d & 0xFF, cb, fb);
+		}
+	}
+}
+
+/* Returns false when the label needs Pango: complex text, a glyph missing
+ * from the primary face, or no usable face at all */
+bool glyph_cache_render(struct wsk_glyph_cache *cache, const char *text,
+		int height, int baseline, uint32_t fg, uint32_t bg,
+		struct wsk_image *tile) {
+	size_t n = 0;
+	for (const char *p = text; cache->font && p && *p; ++n) {
+		uint32_t cp;
+		p = utf8_next(p, &cp);
+		if (!p || !simple_codepoint(cp)) {
+			n = 0;
+			break;
+		}
+	}
+	if (n == 0 || n > WSK_GLYPHS_MAX) {
+		++cache->fallbacks;
+		return false;
+	}
+
+	if (cache->budget && cache->mask_bytes > cache->budget) {
+		flush_glyphs(cache);
+	}
+
+	cairo_glyph_t buf[WSK_GLYPHS_MAX];
+	cairo_glyph_t *glyphs = buf;
+	int nglyphs = WSK_GLYPHS_MAX;
+	if (cairo_scaled_font_text_to_glyphs(cache->font, 0, 0, text, -1,
+				&glyphs, &nglyphs, NULL, NULL, NULL) != CAIRO_STATUS_SUCCESS) {
+		++cache->fallbacks;
+		return false;
+	}
+	bool found = nglyphs > 0;
+	for (int i = 0; i < nglyphs; ++i) {
+		found = found && glyphs[i].index != 0;
+	}
+	if (!found) {
+		if (glyphs != buf) {
+			cairo_glyph_free(glyphs);
+		}
+		++cache->fallbacks;
+		return false;
+	}
+
+	const struct wsk_glyph *last = get_glyph(cache, glyphs[nglyphs - 1].index);
+	const long width = lround(glyphs[nglyphs - 1].x) + last->advance;
+	image_resize(tile, width > 0 ? width : 0, height);
+	image_fill(tile, 0, 0, tile->width, tile->height, image_pixel(bg));
+	for (int i = 0; i < nglyphs; ++i) {
+		const struct wsk_glyph *glyph = get_glyph(cache, glyphs[i].index);
+		blend_glyph(tile, glyph, lround(glyphs[i].x) + glyph->left,
+				baseline + glyph->top, fg, cache->gray);
+	}
+	if (glyphs != buf) {
+		cairo_glyph_free(glyphs);
+	}
+	return true;
+}
+
+size_t glyph_cache_memory(const struct wsk_glyph_cache *cache) {
+	size_t bytes = cache->glyphs ?
+		(cache->mask + 1) * sizeof(struct wsk_glyph) : 0;
+	for (size_t i = 0; cache->glyphs && i <= cache->mask; ++i) {
+		bytes += image_memory(&cache->glyphs[i].mask);
+	}
+	return bytes;
+}
+
+void glyph_cache_finish(struct wsk_glyph_cache *cache) {
+	for (size_t i = 0; cache->glyphs && i <= cache->mask; ++i) {
+		image_finish(&cache->glyphs[i].mask);
+	}
+	free(cache->glyphs);
+	if (cache->font) {
+		cairo_scaled_font_destroy(cache->font);
+	}
+	memset(cache, 0, sizeof(*cache));
+}
@@ -0,0 +1,42 @@
+#ifndef _WSK_GLYPHS_H
+#define _WSK_GLYPHS_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cairo/cairo.h>
+#include <pango/pangocairo.h>
+#include "image.h"
+
+/* One glyph's coverage, drawn once: a byte per color channel, equal unless
+ * the font options ask for subpixel antialiasing */
+struct wsk_glyph {
+	// Glyph index + 1, 0 for an empty slot
+	unsigned long key;
+	struct wsk_image mask;
+	int left, top, advance;
+};
+
+/*
+ * Draws labels straight from the primary face of the configured font, for
+ * text that needs no shaping and no fallback fonts: ASCII and the special
+ * key symbols. Everything else is left to Pango.
+ */
+struct wsk_glyph_cache {
+	cairo_scaled_font_t *font;
+	// Grayscale antialiasing: one coverage value for every channel
+	bool gray;
+	struct wsk_glyph *glyphs;
+	size_t count, mask;
+	// Past this many bytes of masks every glyph is dropped; 0 for no limit
+	size_t budget, mask_bytes;
+	uint64_t hits, misses, fallbacks, flushes;
+};
+
+void glyph_cache_init(struct wsk_glyph_cache *cache, PangoLayout *layout);
+bool glyph_cache_render(struct wsk_glyph_cache *cache, const char *text,
+		int height, int baseline, uint32_t fg, uint32_t bg,
+		struct wsk_image *tile);
+size_t glyph_cache_memory(const struct wsk_glyph_cache *cache);
+void glyph_cache_finish(struct wsk_glyph_cache *cache);
+
+#endif
@@ -0,0 +1,113 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+
+uint32_t image_pixel(uint32_t rgba) {
+	const uint32_t a = rgba & 0xFF;
+	const uint32_t r = (rgba >> 24 & 0xFF) * a / 0xFF;
+	const uint32_t g = (rgba >> 16 & 0xFF) * a / 0xFF;
+	const uint32_t b = (rgba >> 8 & 0xFF) * a / 0xFF;
+	return a << 24 | r << 16 | g << 8 | b;
+}
+
+/* Returns true when the pixels had to be reallocated; their contents are
+ * undefined then. */
+bool image_resize(struct wsk_image *image, uint32_t width, uint32_t height) {
+	image->width = width;
+	image->height = height;
+	if (width <= image->stride
+			&& (size_t)image->stride * height <= image->capacity) {
+		return false;
+	}
+
+	// Rows a cache line apart, so a strip growing a key at a time
+	// reallocates now and then rather than on every key
+	const uint32_t stride = width > image->stride ?
+		(width + 15) & ~15u : image->stride;
+	size_t capacity = (size_t)stride * height;
+	if (capacity < image->capacity) {
+		capacity = image->capacity;
+	}
+	free(image->pixels);
+	image->pixels = malloc(capacity * sizeof(uint32_t));
+	assert(image->pixels);
+	image->stride = stride;
+	image->capacity = capacity;
+	return true;
+}
+
+void image_fill(struct wsk_image *image, uint32_t x, uint32_t y,
+		uint32_t width, uint32_t height, uint32_t pixel) {
+	if (x >= image->width || y >= image->height) {
+		return;
+	}
+	if (width > image->width - x) {
+		width = image->width - x;
+	}
+	if (height > image->height - y) {
+		height = image->height - y;
+	}
+	for (uint32_t row = y; row < y + height; ++row) {
+		uint32_t *dst = image->pixels + (size_t)row * image->stride + x;
+		for (uint32_t i = 0; i < width; ++i) {
+			dst[i] = pixel;
+		}
+	}
+}
+
+void image_blit(struct wsk_image *dst, uint32_t x, uint32_t y,
+		const struct wsk_image *src) {
+	if (x >= dst->width || y >= dst->height || !src->width) {
+		return;
+	}
+	const uint32_t width = src->width < dst->width - x ?
+		src->width : dst->width - x;
+	const uint32_t height = src->height < dst->height - y ?
+		src->height : dst->height - y;
+	for (uint32_t row = 0; row < height; ++row) {
+		memcpy(dst->pixels + (size_t)(y + row) * dst->stride + x,
+				src->pixels + (size_t)row * src->stride,
+				width * sizeof(uint32_t));
+	}
+}
+
+/* Moves a block of pixels within the buffer. Rows past the current size
+ * still hold what was drawn before the image shrank, so they may be the
+ * source. */
+void image_move(struct wsk_image *image, uint32_t dst_x, uint32_t dst_y,
+		uint32_t src_x, uint32_t src_y, uint32_t width, uint32_t height) {
+	if (!image->stride) {
+		return;
+	}
+	const uint32_t rows = image->capacity / image->stride;
+	const uint32_t x = dst_x > src_x ? dst_x : src_x;
+	const uint32_t y = dst_y > src_y ? dst_y : src_y;
+	if (x >= image->stride || y >= rows) {
+		return;
+	}
+	if (width > image->stride - x) {
+		width = image->stride - x;
+	}
+	if (height > rows - y) {
+		height = rows - y;
+	}
+	// Scrolling up copies rows top down, scrolling down bottom up
+	for (uint32_t i = 0; i < height; ++i) {
+		const uint32_t row = dst_y <= src_y ? i : height - 1 - i;
+		memmove(image->pixels + (size_t)(dst_y + row) * image->stride + dst_x,
+				image->pixels + (size_t)(src_y + row) * image->stride + src_x,
+				width * sizeof(uint32_t));
+	}
+}
+
+size_t image_memory(const struct wsk_image *image) {
+	return image->capacity * sizeof(uint32_t);
+}
+
+void image_finish(struct wsk_image *image) {
+	free(image->pixels);
+	memset(image, 0, sizeof(*image));
+}
@@ -0,0 +1,29 @@
+#ifndef _WSK_IMAGE_H
+#define _WSK_IMAGE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Premultiplied ARGB32 pixels, laid out like a cairo ARGB32 image. The pixel
+ * buffer only ever grows, so drawing again at the same or a smaller size
+ * reuses it.
+ */
+struct wsk_image {
+	uint32_t *pixels;
+	uint32_t width, height, stride;
+	size_t capacity;
+};
+
+uint32_t image_pixel(uint32_t rgba);
+bool image_resize(struct wsk_image *image, uint32_t width, uint32_t height);
+void image_fill(struct wsk_image *image, uint32_t x, uint32_t y,
+		uint32_t width, uint32_t height, uint32_t pixel);
+void image_blit(struct wsk_image *dst, uint32_t x, uint32_t y,
+		const struct wsk_image *src);
+void image_move(struct wsk_image *image, uint32_t dst_x, uint32_t dst_y,
+		uint32_t src_x, uint32_t src_y, uint32_t width, uint32_t height);
+size_t image_memory(const struct wsk_image *image);
+void image_finish(struct wsk_image *image);
+
+#endif
@@ -0,0 +1,314 @@
+#define _GNU_SOURCE // struct ucred
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "ipc.h"
+
+static int set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		return -1;
+	}
+	return fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+int ipc_init(struct wsk_ipc *ipc, const char *path,
+		wsk_ipc_handler handler, void *data) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "IPC socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	ipc->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (ipc->fd == -1 || set_nonblocking(ipc->fd) == -1) {
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		if (ipc->fd != -1) {
+			close(ipc->fd);
+		}
+		return -1;
+	}
+	// Only ever replace a stale socket, never whatever else is there
+	struct stat st;
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "%s exists and is not a socket\n", path);
+			close(ipc->fd);
+			ipc->fd = -1;
+			return -1;
+		}
+		unlink(path);
+	}
+	// Statistics and the key feed are for this user alone
+	const mode_t mask = umask(0077);
+	const int bound = bind(ipc->fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (bound == -1 || chmod(path, 0600) == -1
+			|| listen(ipc->fd, WSK_IPC_MAX_CLIENTS) == -1) {
+		fprintf(stderr, "Unable to listen on %s: %s\n", path, strerror(errno));
+		close(ipc->fd);
+		ipc->fd = -1;
+		return -1;
+	}
+	ipc->path = strdup(path);
+	ipc->handler = handler;
+	ipc->data = data;
+	ipc->nclients = 0;
+	fprintf(stdout, "Listening on %s\n", path);
+	return 0;
+}
+
+static bool same_user(int fd) {
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0
+		&& cred.uid == getuid();
+}
+
+/* Checked again before handing out a descriptor, rather than trusting that
+ * the socket mode kept everyone else out */
+bool ipc_client_is_user(const struct wsk_ipc_client *client) {
+	return same_user(client->fd);
+}
+
+static void client_close(struct wsk_ipc_client *client) {
+	close(client->fd);
+	client->fd = -1;
+	free(client->out);
+	client->out = NULL;
+	client->out_len = client->out_size = 0;
+}
+
+void ipc_finish(struct wsk_ipc *ipc) {
+	if (!ipc->path) {
+		return;
+	}
+	for (size_t i = 0; i < ipc->nclients; ++i) {
+		client_close(&ipc->clients[i]);
+	}
+	close(ipc->fd);
+	unlink(ipc->path);
+	free(ipc->path);
+	ipc->path = NULL;
+}
+
+size_t ipc_fill_pollfds(const struct wsk_ipc *ipc, struct pollfd *fds) {
+	if (!ipc->path) {
+		return 0;
+	}
+	// Stop accepting while every client slot is taken
+	fds[0] = (struct pollfd){
+		.fd = ipc->nclients < WSK_IPC_MAX_CLIENTS ? ipc->fd : -1,
+		.events = POLLIN,
+	};
+	for (size_t i = 0; i < ipc->nclients; ++i) {
+		const struct wsk_ipc_client *client = &ipc->clients[i];
+		fds[i + 1] = (struct pollfd){
+			.fd = client->fd,
+			.events = (client->closing ? 0 : POLLIN)
+				| (client->out_len ? POLLOUT : 0),
+		};
+	}
+	return ipc->nclients + 1;
+}
+
+/* Room for len more bytes of output; NULL when the client is gone */
+static char *reserve(struct wsk_ipc_client *client, size_t len) {
+	if (client->fd == -1 || client->closing) {
+		return NULL;
+	}
+	if (client->out_len + len > WSK_IPC_MAX_PENDING) {
+		// Not reading its replies; give up on it
+		client->closing = true;
+		client->out_len = 0;
+		return NULL;
+	}
+	if (client->out_len + len > client->out_size) {
+		size_t size = client->out_size ? client->out_size : 4096;
+		while (client->out_len + len > size) {
+			size *= 2;
+		}
+		client->out = realloc(client->out, size);
+		assert(client->out);
+		client->out_size = size;
+	}
+	return client->out + client->out_len;
+}
+
+void ipc_reply(struct wsk_ipc_client *client, const void *data, size_t len) {
+	char *out = reserve(client, len);
+	if (!out) {
+		return;
+	}
+	memcpy(out, data, len);
+	client->out_len += len;
+}
+
+/* Formats straight into the output buffer, however long the result */
+void ipc_printf(struct wsk_ipc_client *client, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	const int len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+	char *out;
+	if (len < 0 || !(out = reserve(client, len + 1))) {
+		return;
+	}
+	va_start(args, fmt);
+	vsnprintf(out, len + 1, fmt, args);
+	va_end(args);
+	client->out_len += len;
+}
+
+/* A JSON string literal, quotes included */
+void ipc_reply_json(struct wsk_ipc_client *client, const char *text) {
+	ipc_reply(client, "\"", 1);
+	for (const char *p = text; *p; ++p) {
+		const unsigned char c = *p;
+		if (c == '"' || c == '\\') {
+			ipc_printf(client, "\\%c", c);
+		} else if (c < 0x20 || c == 0x7F) {
+			ipc_printf(client, "\\u%04x", c);
+		} else {
+			ipc_reply(client, p, 1);
+		}
+	}
+	ipc_reply(client, "\"", 1);
+}
+
+/* The descriptor goes out with the first bytes the socket takes; the
+ * receiver finds it with whichever read returns them */
+void ipc_reply_fd(struct wsk_ipc_client *client, const char *line, int fd) {
+	client->pass_fd = fd;
+	ipc_reply(client, line, strlen(line));
+}
+
+static ssize_t client_send(struct wsk_ipc_client *client) {
+	if (client->pass_fd == -1) {
+		return send(client->fd, client->out, client->out_len,
+				MSG_NOSIGNAL | MSG_DONTWAIT);
+	}
+	union {
+		struct cmsghdr header;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct iovec iov = { client->out, client->out_len };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &client->pass_fd, sizeof(int));
+	const ssize_t n = sendmsg(client->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (n > 0) {
+		client->pass_fd = -1;
+	}
+	return n;
+}
+
+static void client_flush(struct wsk_ipc_client *client) {
+	while (client->out_len) {
+		ssize_t n = client_send(client);
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				client->closing = true;
+				client->out_len = 0;
+			}
+			return;
+		}
+		memmove(client->out, client->out + n, client->out_len - n);
+		client->out_len -= n;
+	}
+}
+
+static void client_read(struct wsk_ipc *ipc, struct wsk_ipc_client *client) {
+	ssize_t n = read(client->fd, client->in + client->in_len,
+			sizeof(client->in) - client->in_len);
+	if (n <= 0) {
+		if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+			client->closing = true;
+		}
+		return;
+	}
+	client->in_len += n;
+
+	char *line = client->in;
+	char *end;
+	while (!client->closing &&
+			(end = memchr(line, '\n', client->in + client->in_len - line))) {
+		*end = '\0';
+		if (end > line && end[-1] == '\r') {
+			end[-1] = '\0';
+		}
+		ipc->handler(ipc->data, client, line);
+		line = end + 1;
+	}
+	client->in_len -= line - client->in;
+	memmove(client->in, line, client->in_len);
+	if (client->in_len == sizeof(client->in)) {
+		ipc_printf(client, "error: line too long\n");
+		client->closing = true;
+	}
+}
+
+void ipc_dispatch(struct wsk_ipc *ipc, const struct pollfd *fds) {
+	if (!ipc->path) {
+		return;
+	}
+	for (size_t i = 0; i < ipc->nclients; ++i) {
+		struct wsk_ipc_client *client = &ipc->clients[i];
+		if (fds[i + 1].revents & POLLIN) {
+			client_read(ipc, client);
+		} else if (fds[i + 1].revents & (POLLHUP | POLLERR)) {
+			client->closing = true;
+		}
+		client_flush(client);
+	}
+
+	// Drop finished clients, keeping the rest in order
+	size_t kept = 0;
+	for (size_t i = 0; i < ipc->nclients; ++i) {
+		struct wsk_ipc_client *client = &ipc->clients[i];
+		if (client->closing && !client->out_len) {
+			client_close(client);
+		} else {
+			ipc->clients[kept++] = *client;
+		}
+	}
+	ipc->nclients = kept;
+
+	if (!(fds[0].revents & POLLIN)) {
+		return;
+	}
+	while (ipc->nclients < WSK_IPC_MAX_CLIENTS) {
+		int fd = accept(ipc->fd, NULL, NULL);
+		if (fd == -1) {
+			break;
+		}
+		if (!same_user(fd) || set_nonblocking(fd) == -1) {
+			close(fd);
+			continue;
+		}
+		ipc->clients[ipc->nclients++] = (struct wsk_ipc_client){
+			.fd = fd,
+			.pass_fd = -1,
+		};
+	}
+}
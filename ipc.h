@@ -0,0 +1,54 @@
+#ifndef _WSK_IPC_H
+#define _WSK_IPC_H
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define WSK_IPC_MAX_CLIENTS 8
+#define WSK_IPC_MAX_LINE 512
+#define WSK_IPC_MAX_PENDING (1 << 20)
+
+/*
+ * Line-based requests on a non-blocking UNIX socket. Replies are queued and
+ * flushed as the socket accepts them, so a slow client never stalls the
+ * main loop.
+ */
+struct wsk_ipc_client {
+	int fd;
+	bool closing;
+	char in[WSK_IPC_MAX_LINE];
+	size_t in_len;
+	char *out;
+	size_t out_len, out_size;
+	// Sent along with the next bytes of output; not owned
+	int pass_fd;
+};
+
+struct wsk_ipc;
+typedef void (*wsk_ipc_handler)(void *data,
+		struct wsk_ipc_client *client, char *line);
+
+struct wsk_ipc {
+	int fd;
+	char *path;
+	wsk_ipc_handler handler;
+	void *data;
+	struct wsk_ipc_client clients[WSK_IPC_MAX_CLIENTS];
+	size_t nclients;
+};
+
+#define WSK_IPC_POLLFDS (1 + WSK_IPC_MAX_CLIENTS)
+
+int ipc_init(struct wsk_ipc *ipc, const char *path,
+		wsk_ipc_handler handler, void *data);
+void ipc_finish(struct wsk_ipc *ipc);
+size_t ipc_fill_pollfds(const struct wsk_ipc *ipc, struct pollfd *fds);
+void ipc_dispatch(struct wsk_ipc *ipc, const struct pollfd *fds);
+void ipc_reply(struct wsk_ipc_client *client, const void *data, size_t len);
+void ipc_printf(struct wsk_ipc_client *client, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void ipc_reply_json(struct wsk_ipc_client *client, const char *text);
+void ipc_reply_fd(struct wsk_ipc_client *client, const char *line, int fd);
+bool ipc_client_is_user(const struct wsk_ipc_client *client);
+
+#endif
@@ -0,0 +1,88 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <xkbcommon/xkbcommon.h>
+#include "keymap.h"
+
+uint64_t keymap_hash(const char *text, size_t size) {
+	/* FNV-1a, eight bytes per round */
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, text + i, sizeof(word));
+		hash = (hash ^ word) * 0x100000001b3ULL;
+	}
+	for (; i < size; ++i) {
+		hash = (hash ^ (unsigned char)text[i]) * 0x100000001b3ULL;
+	}
+	return hash ^ (hash >> 32);
+}
+
+static double elapsed_ms(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3
+		+ (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void entry_finish(struct wsk_keymap_entry *entry) {
+	xkb_keymap_unref(entry->keymap);
+	free(entry->text);
+	labels_finish(&entry->labels);
+	memset(entry, 0, sizeof(*entry));
+}
+
+/* *labels points into the cache and is only good until the next call */
+struct xkb_keymap *keymap_cache_get(struct wsk_keymap_cache *cache,
+		struct xkb_context *context, const struct wsk_symtab *symbols,
+		const char *text, size_t size, const struct wsk_labels **labels) {
+	const uint64_t hash = keymap_hash(text, size);
+	struct wsk_keymap_entry *victim = &cache->entries[0];
+
+	++cache->tick;
+	for (size_t i = 0; i < WSK_KEYMAP_CACHE_SIZE; ++i) {
+		struct wsk_keymap_entry *entry = &cache->entries[i];
+		if (entry->keymap && entry->hash == hash && entry->size == size
+				&& memcmp(entry->text, text, size) == 0) {
+			entry->last_used = cache->tick;
+			++cache->hits;
+			*labels = &entry->labels;
+			return xkb_keymap_ref(entry->keymap);
+		}
+		if (!entry->keymap || (victim->keymap
+					&& entry->last_used < victim->last_used)) {
+			victim = entry;
+		}
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	struct xkb_keymap *keymap = xkb_keymap_new_from_string(context,
+			text, XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	if (!keymap) {
+		return NULL;
+	}
+	++cache->compiles;
+	cache->compile_ms += elapsed_ms(&start);
+
+	entry_finish(victim);
+	victim->hash = hash;
+	victim->size = size;
+	victim->text = malloc(size);
+	assert(victim->text);
+	memcpy(victim->text, text, size);
+	victim->keymap = keymap;
+	victim->last_used = cache->tick;
+	labels_prefill(&victim->labels, keymap, symbols);
+	*labels = &victim->labels;
+	return xkb_keymap_ref(keymap);
+}
+
+void keymap_cache_finish(struct wsk_keymap_cache *cache) {
+	for (size_t i = 0; i < WSK_KEYMAP_CACHE_SIZE; ++i) {
+		entry_finish(&cache->entries[i]);
+	}
+	memset(cache, 0, sizeof(*cache));
+}
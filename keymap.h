@@ -0,0 +1,36 @@
+#ifndef _WSK_KEYMAP_H
+#define _WSK_KEYMAP_H
+#include <stddef.h>
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+#include "labels.h"
+#include "symtab.h"
+
+/* Compositors resend the keymap on every layout switch; keep the last few. */
+#define WSK_KEYMAP_CACHE_SIZE 4
+
+/* The text is kept to tell hash collisions apart. The labels are those
+ * labels_prefill finds in the keymap, interned once per compile. */
+struct wsk_keymap_entry {
+	uint64_t hash;
+	size_t size;
+	char *text;
+	struct xkb_keymap *keymap;
+	struct wsk_labels labels;
+	uint64_t last_used;
+};
+
+struct wsk_keymap_cache {
+	struct wsk_keymap_entry entries[WSK_KEYMAP_CACHE_SIZE];
+	uint64_t tick;
+	unsigned int compiles, hits;
+	double compile_ms;
+};
+
+uint64_t keymap_hash(const char *text, size_t size);
+struct xkb_keymap *keymap_cache_get(struct wsk_keymap_cache *cache,
+		struct xkb_context *context, const struct wsk_symtab *symbols,
+		const char *text, size_t size, const struct wsk_labels **labels);
+void keymap_cache_finish(struct wsk_keymap_cache *cache);
+
+#endif
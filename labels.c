@@ -0,0 +1,152 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xkbcommon/xkbcommon.h>
+#include "labels.h"
+#include "symtab.h"
+
+bool labels_printable(const char *utf8) {
+	const unsigned char c = utf8[0];
+	return c > ' ' && !(c >= 0x7F && c <= 0x9F);
+}
+
+static uint32_t label_hash(const char *text) {
+	uint32_t hash = 2166136261u;
+	for (; *text; ++text) {
+		hash = (hash ^ (unsigned char)*text) * 16777619u;
+	}
+	return hash;
+}
+
+static void grow_index(struct wsk_labels *labels) {
+	const size_t size = labels->index ? (labels->index_mask + 1) * 2 : 64;
+	free(labels->index);
+	labels->index = calloc(size, sizeof(uint16_t));
+	assert(labels->index);
+	labels->index_mask = size - 1;
+	for (uint16_t id = 0; id < labels->count; ++id) {
+		size_t slot = label_hash(labels_get(labels, id)) & labels->index_mask;
+		while (labels->index[slot]) {
+			slot = (slot + 1) & labels->index_mask;
+		}
+		labels->index[slot] = id + 1;
+	}
+}
+
+uint16_t labels_intern(struct wsk_labels *labels, const char *text) {
+	if (!labels->index) {
+		grow_index(labels);
+	}
+	size_t slot = label_hash(text) & labels->index_mask;
+	for (; labels->index[slot]; slot = (slot + 1) & labels->index_mask) {
+		const uint16_t id = labels->index[slot] - 1;
+		if (strcmp(labels_get(labels, id), text) == 0) {
+			return id;
+		}
+	}
+	if (labels->count == WSK_LABEL_NONE - 1) {
+		return WSK_LABEL_NONE;
+	}
+
+	const size_t len = strlen(text) + 1;
+	if (labels->arena_len + len > labels->arena_size) {
+		size_t size = labels->arena_size ? labels->arena_size : 256;
+		while (labels->arena_len + len > size) {
+			size *= 2;
+		}
+		labels->arena = realloc(labels->arena, size);
+		assert(labels->arena);
+		labels->arena_size = size;
+	}
+	if (labels->count == labels->size) {
+		unsigned int size = labels->size ? labels->size * 2u : 64;
+		if (size >= WSK_LABEL_NONE) {
+			size = WSK_LABEL_NONE - 1;
+		}
+		labels->size = size;
+		labels->offsets = realloc(labels->offsets,
+				labels->size * sizeof(uint32_t));
+		assert(labels->offsets);
+	}
+
+	const uint16_t id = labels->count++;
+	labels->offsets[id] = labels->arena_len;
+	memcpy(labels->arena + labels->arena_len, text, len);
+	labels->arena_len += len;
+	labels->index[slot] = id + 1;
+
+	// Keep the index at most half full
+	if (labels->count * 2 > labels->index_mask + 1) {
+		grow_index(labels);
+	}
+	return id;
+}
+
+uint16_t labels_intern_keysym(struct wsk_labels *labels,
+		const struct wsk_symtab *symbols, xkb_keysym_t sym) {
+	const char *label = symtab_lookup(symbols, sym);
+	if (label) {
+		return labels_intern(labels, label);
+	}
+	char name[64];
+	if (xkb_keysym_get_name(sym, name, sizeof(name)) < 0) {
+		return WSK_LABEL_NONE;
+	}
+	return labels_intern(labels, name);
+}
+
+void labels_prefill(struct wsk_labels *labels, struct xkb_keymap *keymap,
+		const struct wsk_symtab *symbols) {
+	// Unmodified and shifted symbols of the first layout cover nearly every
+	// label; anything else is interned when it is first typed
+	const xkb_keycode_t min = xkb_keymap_min_keycode(keymap);
+	const xkb_keycode_t max = xkb_keymap_max_keycode(keymap);
+	for (xkb_keycode_t keycode = min; keycode <= max; ++keycode) {
+		const xkb_level_index_t levels =
+			xkb_keymap_num_levels_for_key(keymap, keycode, 0);
+		for (xkb_level_index_t level = 0; level < levels && level < 2; ++level) {
+			const xkb_keysym_t *syms;
+			const int n = xkb_keymap_key_get_syms_by_level(keymap,
+					keycode, 0, level, &syms);
+			for (int i = 0; i < n; ++i) {
+				char utf8[16];
+				if (xkb_keysym_to_utf8(syms[i], utf8, sizeof(utf8)) > 0
+						&& labels_printable(utf8)) {
+					labels_intern(labels, utf8);
+				} else {
+					labels_intern_keysym(labels, symbols, syms[i]);
+				}
+			}
+		}
+	}
+}
+
+/* In order, so an empty table ends up with the same ids as the source */
+void labels_intern_all(struct wsk_labels *labels,
+		const struct wsk_labels *from) {
+	for (uint16_t id = 0; id < from->count; ++id) {
+		labels_intern(labels, labels_get(from, id));
+	}
+}
+
+size_t labels_memory(const struct wsk_labels *labels) {
+	return labels->arena_size + labels->size * sizeof(uint32_t)
+		+ (labels->index ? (labels->index_mask + 1) * sizeof(uint16_t) : 0);
+}
+
+void labels_reset(struct wsk_labels *labels) {
+	labels->arena_len = 0;
+	labels->count = 0;
+	++labels->generation;
+	if (labels->index) {
+		memset(labels->index, 0,
+				(labels->index_mask + 1) * sizeof(uint16_t));
+	}
+}
+
+void labels_finish(struct wsk_labels *labels) {
+	free(labels->arena);
+	free(labels->offsets);
+	free(labels->index);
+	memset(labels, 0, sizeof(*labels));
+}
@@ -0,0 +1,41 @@
+#ifndef _WSK_LABELS_H
+#define _WSK_LABELS_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+#include "symtab.h"
+
+#define WSK_LABEL_NONE UINT16_MAX
+
+/* Interned key labels: NUL-terminated strings packed in one arena and
+ * addressed by small ids, looked up through an open-addressed index. */
+struct wsk_labels {
+	char *arena;
+	size_t arena_len, arena_size;
+	uint32_t *offsets;
+	uint16_t count, size;
+	uint16_t *index;
+	size_t index_mask;
+	// Bumped by labels_reset, when ids start naming other strings
+	uint32_t generation;
+};
+
+bool labels_printable(const char *utf8);
+uint16_t labels_intern(struct wsk_labels *labels, const char *text);
+uint16_t labels_intern_keysym(struct wsk_labels *labels,
+		const struct wsk_symtab *symbols, xkb_keysym_t sym);
+void labels_prefill(struct wsk_labels *labels, struct xkb_keymap *keymap,
+		const struct wsk_symtab *symbols);
+void labels_intern_all(struct wsk_labels *labels,
+		const struct wsk_labels *from);
+size_t labels_memory(const struct wsk_labels *labels);
+void labels_reset(struct wsk_labels *labels);
+void labels_finish(struct wsk_labels *labels);
+
+static inline const char *labels_get(const struct wsk_labels *labels,
+		uint16_t id) {
+	return labels->arena + labels->offsets[id];
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef __FreeBSD__
+#define _GNU_SOURCE // SCHED_RESET_ON_FORK
+#endif
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include "latency.h"
+
+static size_t bucket_of(uint64_t us) {
+	if (us < 8) {
+		return us;
+	}
+	const int msb = 63 - __builtin_clzll(us);
+	const size_t bucket = (msb - 2) * 8 + ((us >> (msb - 3)) & 7);
+	return bucket < WSK_LATENCY_BUCKETS ? bucket : WSK_LATENCY_BUCKETS - 1;
+}
+
+static uint64_t bucket_floor(size_t bucket) {
+	if (bucket < 8) {
+		return bucket;
+	}
+	return (8 + bucket % 8) << (bucket / 8 - 1);
+}
+
+void latency_record(struct wsk_latency *latency, uint64_t us) {
+	++latency->buckets[bucket_of(us)];
+	++latency->count;
+	latency->sum_us += us;
+	if (us > latency->max_us) {
+		latency->max_us = us;
+	}
+}
+
+/* The lower edge of the bucket holding the p-th sample, within 12.5% */
+uint64_t latency_percentile(const struct wsk_latency *latency, double p) {
+	const uint64_t rank = latency->count * p;
+	uint64_t seen = 0;
+	for (size_t i = 0; i < WSK_LATENCY_BUCKETS; ++i) {
+		seen += latency->buckets[i];
+		if (seen > rank) {
+			return bucket_floor(i);
+		}
+	}
+	return latency->max_us;
+}
+
+void latency_report(const struct wsk_latency *latency,
+		const char *name, FILE *f) {
+	if (!latency->count) {
+		fprintf(f, "%s: no input batches timed yet\n", name);
+		return;
+	}
+	const uint64_t p50 = latency_percentile(latency, 0.5);
+	const uint64_t p99 = latency_percentile(latency, 0.99);
+	fprintf(f, "%s: %llu batches, input to commit %llu us mean, "
+			"%llu us p50, %llu us p99, %llu us max, %llu us jitter "
+			"(p99 - p50)\n", name,
+			(unsigned long long)latency->count,
+			(unsigned long long)(latency->sum_us / latency->count),
+			(unsigned long long)p50, (unsigned long long)p99,
+			(unsigned long long)latency->max_us,
+			(unsigned long long)(p99 - p50));
+}
+
+#ifndef SCHED_RESET_ON_FORK
+#define SCHED_RESET_ON_FORK 0
+#endif
+
+/* The policy of this thread, without the reset-on-fork flag --low-latency
+ * sets along with it */
+int latency_policy(void) {
+	const int policy = sched_getscheduler(0);
+	return policy == -1 ? policy : policy & ~SCHED_RESET_ON_FORK;
+}
+
+const char *latency_policy_name(int policy) {
+	switch (policy) {
+	case SCHED_FIFO:
+		return "SCHED_FIFO";
+	case SCHED_RR:
+		return "SCHED_RR";
+	default:
+		return "SCHED_OTHER";
+	}
+}
+
+/* What the scheduler and the pager are doing to us, for comparing runs with
+ * and without --low-latency */
+void latency_report_process(FILE *f) {
+	struct sched_param param = { 0 };
+	sched_getparam(0, &param);
+	struct rusage usage = { 0 };
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(f, "Scheduling: %s priority %d, nice %d; %ld minor and "
+			"%ld major page faults, %ld involuntary context switches\n",
+			latency_policy_name(latency_policy()),
+			param.sched_priority, getpriority(PRIO_PROCESS, 0),
+			usage.ru_minflt, usage.ru_majflt, usage.ru_nivcsw);
+}
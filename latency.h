@@ -0,0 +1,23 @@
+#ifndef _WSK_LATENCY_H
+#define _WSK_LATENCY_H
+#include <stdint.h>
+#include <stdio.h>
+
+/* Eight buckets per power of two, from 1 us to over an hour */
+#define WSK_LATENCY_BUCKETS 256
+
+/* Recording is constant time and never allocates. */
+struct wsk_latency {
+	uint64_t count, sum_us, max_us;
+	uint32_t buckets[WSK_LATENCY_BUCKETS];
+};
+
+void latency_record(struct wsk_latency *latency, uint64_t us);
+uint64_t latency_percentile(const struct wsk_latency *latency, double p);
+void latency_report(const struct wsk_latency *latency,
+		const char *name, FILE *f);
+int latency_policy(void);
+const char *latency_policy_name(int policy);
+void latency_report_process(FILE *f);
+
+#endif
@@ -1,58 +1,182 @@
 #include "main.h"
 
-static void cairo_set_source_u32(cairo_t *cairo, const uint32_t color) {
-	cairo_set_source_rgba(cairo,
-			(color >> (3*8) & 0xFF) / 255.0,
-			(color >> (2*8) & 0xFF) / 255.0,
-			(color >> (1*8) & 0xFF) / 255.0,
-			(color >> (0*8) & 0xFF) / 255.0);
-}
-
-// 화면을 벗어나는 키들을 제거하는 함수
-static void trim_keys_by_width(struct wsk_state *state) {
-	if (!state->keys) return;
-
-    const uint32_t max_width = 1800;  // 안전 마진 포함
-
-    // 🔥 간단: 현재 키들의 총 너비 계산
-    cairo_surface_t *temp_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
-    cairo_t *temp_cairo = cairo_create(temp_surface);
-
-    uint32_t total_width = 0;
-    const struct wsk_keypress *key = state->keys;
-
-    // 전체 너비 계산
-    while (key) {
-        int w, h;
-        const char *name = key->utf8[0] ? key->utf8 : key->name;
-        get_text_size(temp_cairo, state->font, &w, &h, NULL, 1, "%s ", name);
-        total_width += w;
-        key = key->next;
-    }
+static size_t key_tiles(const struct wsk_seat *seat,
+		const struct wsk_keypress *key, uint16_t tiles[static WSK_KEY_TILES],
+		bool special[static WSK_KEY_TILES]) {
+	size_t n = 0;
+	special[n] = key->flags & WSK_KEY_SPECIAL;
+	tiles[n++] = key->label;
+	if (!special[0] && key->count <= 2) {
+		if (key->count == 2) {
+			special[n] = false;
+			tiles[n++] = key->label;
+		}
+		return n;
+	}
 
-    printf("Total width: %d, max: %d\n", total_width, max_width);
+	// "label xN ", the count in the special key color whatever the label
+	if (key->count > 1) {
+		char digits[8];
+		const int len = snprintf(digits, sizeof(digits), "%u", key->count);
+		special[n] = true;
+		tiles[n++] = seat->count_labels[WSK_COUNT_TIMES];
+		for (int i = 0; i < len; ++i) {
+			special[n] = true;
+			tiles[n++] = seat->count_labels[digits[i] - '0'];
+		}
+	}
+	special[n] = true;
+	tiles[n++] = seat->count_labels[WSK_COUNT_SPACE];
+	return n;
+}
 
-    // 🔥 초과하면 맨 앞 키들 제거
-    while (total_width > max_width && state->keys) {
-        struct wsk_keypress *to_remove = state->keys;
+static const struct wsk_image *get_tile(struct wsk_seat *seat,
+		struct wsk_raster *raster, uint16_t label, bool special) {
+	if (label >= raster->ntiles) {
+		const size_t ntiles = seat->labels.size;
+		for (int i = 0; i < 2; ++i) {
+			raster->tiles[i] = realloc(raster->tiles[i],
+					ntiles * sizeof(struct wsk_image));
+			assert(raster->tiles[i]);
+			memset(raster->tiles[i] + raster->ntiles, 0,
+					(ntiles - raster->ntiles) * sizeof(struct wsk_image));
+		}
+		raster->ntiles = ntiles;
+		++seat->warmups;
+	}
 
-        // 제거할 키의 너비 계산
-        int w, h;
-        const char *name = to_remove->utf8[0] ? to_remove->utf8 : to_remove->name;
-        get_text_size(temp_cairo, state->font, &w, &h, NULL, 1, "%s ", name);
+	struct wsk_image *tile = &raster->tiles[special][label];
+	if (!tile->height) {
+		// Most labels are one character the configured face has; only
+		// the rest needs Pango
+		const struct wsk_state *state = seat->state;
+		const char *text = labels_get(&seat->labels, label);
+		const uint32_t fg = special ? state->specialfg : state->foreground;
+		raster->tile_bytes -= image_memory(tile);
+		if (!glyph_cache_render(&raster->glyphs, text, raster->line_height,
+					raster->baseline, fg, state->background, tile)) {
+			render_label_tile(raster->layout, text, raster->line_height,
+					raster->baseline, fg, state->background, tile);
+		}
+		raster->tile_bytes += image_memory(tile);
+		if (state->memory_budget) {
+			evict_tiles(raster, tile, WSK_BUDGET_TILE_BYTES);
+		}
+		++seat->warmups;
+	}
+	return tile;
+}
 
-        // 키 제거
-        state->keys = state->keys->next;
-        free(to_remove);
+/* Frees other tiles round robin until the rest fit; a tile that is needed
+ * again is drawn again, like any other new tile */
+static void evict_tiles(struct wsk_raster *raster,
+		const struct wsk_image *keep, size_t budget) {
+	const size_t count = 2 * raster->ntiles;
+	for (size_t n = 0; raster->tile_bytes > budget && n < count; ++n) {
+		const size_t i = raster->evict_next++ % count;
+		struct wsk_image *tile = &raster->tiles[i % 2][i / 2];
+		if (tile == keep || !tile->pixels) {
+			continue;
+		}
+		raster->tile_bytes -= image_memory(tile);
+		image_finish(tile);
+		++raster->tiles_evicted;
+	}
+}
 
-        total_width -= w;
-        printf("Removed key, new total width: %d\n", total_width);
-    }
+static uint32_t key_width(struct wsk_seat *seat, struct wsk_raster *raster,
+		const struct wsk_keypress *key) {
+	uint16_t tiles[WSK_KEY_TILES];
+	bool special[WSK_KEY_TILES];
+	const size_t n = key_tiles(seat, key, tiles, special);
+	uint32_t width = 0;
+	for (size_t i = 0; i < n; ++i) {
+		width += get_tile(seat, raster, tiles[i], special[i])->width;
+	}
+	return width;
+}
+
+static int line_width_limit(const struct wsk_seat *seat,
+		const struct wsk_output *output, int scale) {
+	// Logical pixels, so scaled and rotated outputs get the right width
+	if (output && output->logical_width > 0) {
+		const int width = output->logical_width - 2 * seat->state->margin;
+		return (width > 0 ? width : output->logical_width) * scale;
+	}
+	return 1800 * scale;
+}
+
+static void drop_first_line(struct wsk_seat *seat) {
+	const size_t dropped = seat->line_first[1];
+	seat->nkeys -= dropped;
+	seat->evicted += dropped;
+	WSK_TRACE3(trim, trace_now(), dropped, seat->nkeys);
+	memmove(seat->keys, seat->keys + dropped,
+			seat->nkeys * sizeof(struct wsk_keypress));
+
+	--seat->nlines;
+	for (size_t i = 0; i < seat->nlines; ++i) {
+		seat->line_first[i] = seat->line_first[i + 1] - dropped;
+	}
+}
+
+/* Called after each key is appended. When the last line no longer fits the
+ * output, the newest key starts a new line, and the oldest line is dropped
+ * once there are max_lines. With one line, keys are dropped from the front
+ * instead. */
+static void wrap_keys(struct wsk_seat *seat) {
+	if (!seat->nkeys || !seat->surfaces) {
+		return;
+	}
+
+	// Only the last line can have changed; measure it with the tiles the
+	// first surface is drawn from
+	const struct wsk_output *output = seat->surfaces->output;
+	struct wsk_raster *raster = get_raster(seat, output);
+	const size_t last = seat->nlines - 1;
+	const size_t first = seat->line_first[last];
+	const int64_t max = line_width_limit(seat, output, raster->scale);
+	int64_t width = 0;
+	for (size_t i = first; i < seat->nkeys; ++i) {
+		width += key_width(seat, raster, &seat->keys[i]);
+	}
+	if (width <= max || seat->nkeys - first < 2) {
+		return;
+	}
+
+	if (seat->state->max_lines > 1) {
+		// Move the newest key onto a line of its own
+		if (seat->nlines == (size_t)seat->state->max_lines) {
+			drop_first_line(seat);
+		}
+		seat->line_first[seat->nlines++] = seat->nkeys - 1;
+		return;
+	}
 
-    cairo_destroy(temp_cairo);
-    cairo_surface_destroy(temp_surface);
+	// Drop keys from the front until the rest fits, keeping at least one
+	size_t keep = 0;
+	while (keep + 1 < seat->nkeys && width > max) {
+		width -= key_width(seat, raster, &seat->keys[keep]);
+		++keep;
+	}
+	seat->nkeys -= keep;
+	seat->evicted += keep;
+	WSK_TRACE3(trim, trace_now(), keep, seat->nkeys);
+	memmove(seat->keys, seat->keys + keep,
+			seat->nkeys * sizeof(struct wsk_keypress));
 }
 
+static void rewrap_keys(struct wsk_seat *seat) {
+	// Feed the history through the append path again. Dropping a line only
+	// moves keys that were already placed, so reading ahead is safe.
+	const size_t nkeys = seat->nkeys;
+	clear_keys(seat);
+	for (size_t i = 0; i < nkeys; ++i) {
+		seat->keys[seat->nkeys] = seat->keys[i];
+		++seat->nkeys;
+		wrap_keys(seat);
+	}
+}
 
 static cairo_subpixel_order_t to_cairo_subpixel_order(
 		enum wl_output_subpixel subpixel) {
@@ -71,168 +195,487 @@ static cairo_subpixel_order_t to_cairo_subpixel_order(
 	return CAIRO_SUBPIXEL_ORDER_DEFAULT;
 }
 
-static void render_to_cairo(cairo_t *cairo, struct wsk_state *state,
-		int scale, uint32_t *width, uint32_t *height) {
-	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
-	cairo_set_source_u32(cairo, state->background);
-	cairo_paint(cairo);
-
-	// 🔥 실제 화면 너비 사용
-    uint32_t max_width = 800;  // 기본값
-    if (state->output && state->output->width > 0) {
-        max_width = state->output->width - 100;  // 화면 너비 - 마진
-        fprintf(stdout, "Using screen width: %d\n", max_width);
-    } else {
-        fprintf(stdout, "Using default width: %d\n", max_width);
-	}
-
-	const struct wsk_keypress *key = state->keys;
-	while (key) {
-		bool special = false;
-		const char *name = key->utf8;
-		if (!name[0]) {
-			special = true;
-			cairo_set_source_u32(cairo, state->specialfg);
-
-			switch(key->sym) {
-				case XKB_KEY_space:                             name = "⎵"; break;
-				case XKB_KEY_Control_L: case XKB_KEY_Control_R: name = "^"; break;
-				case XKB_KEY_Super_L:   case XKB_KEY_Super_R:   name = "⌘"; break;
-				case XKB_KEY_Alt_L:     case XKB_KEY_Alt_R:     name = "⌥"; break;
-				case XKB_KEY_Shift_L:   case XKB_KEY_Shift_R:   name = "⇧"; break;
-				case XKB_KEY_Return:                            name = "⏎"; break;
-				case XKB_KEY_BackSpace:                         name = "⌫"; break;
-				case XKB_KEY_Delete:                            name = "⌦"; break;
-				case XKB_KEY_Escape:                            name = "⎋"; break;
-				case XKB_KEY_Up:                                name = "↑"; break;
-				case XKB_KEY_Down:                              name = "↓"; break;
-				case XKB_KEY_Left:                              name = "←"; break;
-				case XKB_KEY_Right:                             name = "→"; break;
-				case XKB_KEY_Next:                              name = "↡"; break;
-				case XKB_KEY_Prior:                             name = "↟"; break;
-				case XKB_KEY_Print:                             name = "⎙"; break;
-				case XKB_KEY_Menu:                              name = "≡"; break;
-				case XKB_KEY_Tab:                               name = "⇥"; break;
-				case XKB_KEY_ISO_Left_Tab:                      name = "⇤"; break;
-				case XKB_KEY_Caps_Lock:                         name = "⇪"; break;
-				case XKB_KEY_Home:                              name = "⇱"; break;
-				case XKB_KEY_End:                               name = "⇲"; break;
-				default:                                        name = key->name;
-			}
-		} else {
-			cairo_set_source_u32(cairo, state->foreground);
+static enum wsk_quality choose_quality(const struct wsk_state *state,
+		enum wl_output_subpixel subpixel) {
+	if (state->quality != WSK_QUALITY_AUTO) {
+		return state->quality;
+	}
+	// Per-channel coverage fringes when blended over what is behind us
+	if ((state->background & 0xFF) != 0xFF) {
+		return WSK_QUALITY_FAST;
+	}
+	return to_cairo_subpixel_order(subpixel) == CAIRO_SUBPIXEL_ORDER_DEFAULT ?
+		WSK_QUALITY_BALANCED : WSK_QUALITY_BEST;
+}
+
+static cairo_font_options_t *output_font_options(
+		const struct wsk_state *state, enum wl_output_subpixel subpixel) {
+	return create_font_options(choose_quality(state, subpixel),
+			to_cairo_subpixel_order(subpixel));
+}
+
+static char *build_label_corpus(const struct wsk_state *state) {
+	// Everything a label can be made of: ASCII, the special key symbols and
+	// the digits of repeat counts
+	GString *corpus = g_string_new(NULL);
+	for (char c = '!'; c <= '~'; ++c) {
+		g_string_append_c(corpus, c);
+	}
+	g_string_append(corpus, " x");
+	for (size_t i = 0; i <= state->symbols.slot_mask; ++i) {
+		if (state->symbols.slots[i].label) {
+			g_string_append(corpus, state->symbols.slots[i].label);
 		}
+	}
+	return g_string_free(corpus, FALSE);
+}
 
-		cairo_move_to(cairo, *width, 0);
+static double warm_up_fonts(struct wsk_state *state, int scale,
+		enum wl_output_subpixel subpixel) {
+	cairo_font_options_t *fo = output_font_options(state, subpixel);
+	double ms = font_warm_up(&state->pango_font,
+			state->label_corpus, scale, fo);
+	cairo_font_options_destroy(fo);
+	return ms;
+}
 
-		int w, h;
-		if (special) {
-		    if (key->count > 1) {
-		        get_text_size(cairo, state->font, &w, &h, NULL, scale, "%s x%d ", name, key->count);
-		        pango_printf(cairo, state->font, scale, "%s x%d ", name, key->count);
-		    } else {
-		        get_text_size(cairo, state->font, &w, &h, NULL, scale, "%s ", name);
-		        pango_printf(cairo, state->font, scale, "%s ", name);
-		    }
-		} else {
-			get_text_size(cairo, state->font, &w, &h, NULL, scale, "%s", name);
-			pango_printf(cairo, state->font, scale, "%s", name);
+static void warm_up_output_scales(struct wsk_state *state) {
+	// Scale 1 with unknown subpixels was warmed up while loading the font
+	struct {
+		int scale;
+		enum wsk_quality quality;
+	} done[8] = { { 1, choose_quality(state, WL_OUTPUT_SUBPIXEL_UNKNOWN) } };
+	size_t ndone = 1;
+	for (const struct wsk_output *output = state->outputs;
+			output; output = output->next) {
+		const enum wsk_quality quality =
+			choose_quality(state, output->subpixel);
+		size_t i = 0;
+		while (i < ndone && (done[i].scale != output->scale
+					|| done[i].quality != quality)) {
+			++i;
 		}
+		if (i == ndone && ndone < sizeof(done) / sizeof(done[0])) {
+			done[ndone].scale = output->scale;
+			done[ndone++].quality = quality;
+			state->font_warm_up_ms += warm_up_fonts(state,
+					output->scale, output->subpixel);
+		}
+	}
+	fprintf(stdout, "Font warm-up took %.1f ms\n", state->font_warm_up_ms);
+}
+
+static int measure_line_height(const struct wsk_state *state) {
+	cairo_font_options_t *fo = output_font_options(state,
+			WL_OUTPUT_SUBPIXEL_UNKNOWN);
+	PangoLayout *layout = create_label_layout(&state->pango_font, 1, fo);
+	cairo_font_options_destroy(fo);
+	int height, baseline;
+	label_line_metrics(layout, state->label_corpus, &height, &baseline);
+	g_object_unref(layout);
+	return height;
+}
 
-		*width = *width + w;
-		if ((int)*height < h) {
-			*height = h;
+/* Runs alongside the Wayland setup; the main thread leaves fontconfig and
+ * pango alone until it joins. */
+static int open_font(const struct wsk_state *state,
+		struct wsk_font *font, const char *spec) {
+	if (state->memory_budget) {
+		return font_init_minimal(font, spec, state->fallback_fonts);
+	}
+	return font_init(font, spec);
+}
+
+static void *load_fonts(void *data) {
+	struct wsk_state *state = data;
+	startup_begin(&state->startup, WSK_STARTUP_FONTS);
+	// The memory budget keeps the system configuration out of the process
+	if (!state->memory_budget && !FcInit()) {
+		fprintf(stderr, "Failed to initialize fontconfig\n");
+	} else if (open_font(state, &state->pango_font, state->font) == 0) {
+		state->font_loaded = true;
+		state->label_corpus = build_label_corpus(state);
+		state->font_warm_up_ms = warm_up_fonts(state, 1,
+				WL_OUTPUT_SUBPIXEL_UNKNOWN);
+		state->line_height = measure_line_height(state);
+	}
+#ifdef __GLIBC__
+	if (state->memory_budget) {
+		// Hand back what reading the system configuration left behind
+		malloc_trim(0);
+	}
+#endif
+	startup_end(&state->startup, WSK_STARTUP_FONTS);
+	return NULL;
+}
+
+/* Most sessions have a single seat named seat0: open its devices before the
+ * compositor tells us the seat names. Only the main thread touches udev and
+ * the device manager once this has been joined. */
+static void *enumerate_input(void *data) {
+	struct wsk_state *state = data;
+	startup_begin(&state->startup, WSK_STARTUP_INPUT);
+	struct libinput *libinput = libinput_udev_create_context(
+			&libinput_impl, &state->devmgr, state->udev);
+	if (libinput && libinput_udev_assign_seat(libinput, "seat0") != 0) {
+		libinput_unref(libinput);
+		libinput = NULL;
+	}
+	state->spare_libinput = libinput;
+	startup_end(&state->startup, WSK_STARTUP_INPUT);
+	return NULL;
+}
+
+static struct wsk_raster *get_raster(struct wsk_seat *seat,
+		const struct wsk_output *output) {
+	const int scale = output ? output->scale : 1;
+	const enum wl_output_subpixel subpixel =
+		output ? output->subpixel : WL_OUTPUT_SUBPIXEL_UNKNOWN;
+
+	struct wsk_raster **link = &seat->rasters;
+	for (; *link; link = &(*link)->next) {
+		if ((*link)->scale == scale && (*link)->subpixel == subpixel) {
+			validate_raster(seat, *link);
+			return *link;
 		}
-		key = key->next;
 	}
+
+	struct wsk_raster *raster = calloc(1, sizeof(struct wsk_raster));
+	assert(raster);
+	raster->scale = scale;
+	raster->subpixel = subpixel;
+	*link = raster;
+	validate_raster(seat, raster);
+	return raster;
 }
 
-static void render_frame(struct wsk_state *state) {
-	cairo_surface_t *recorder = cairo_recording_surface_create(
-			CAIRO_CONTENT_COLOR_ALPHA, NULL);
-	cairo_t *cairo = cairo_create(recorder);
-	cairo_set_antialias(cairo, CAIRO_ANTIALIAS_BEST);
-	cairo_font_options_t *fo = cairo_font_options_create();
-	cairo_font_options_set_hint_style(fo, CAIRO_HINT_STYLE_FULL);
-	cairo_font_options_set_antialias(fo, CAIRO_ANTIALIAS_SUBPIXEL);
-	if (state->output) {
-		cairo_font_options_set_subpixel_order(
-				fo, to_cairo_subpixel_order(state->output->subpixel));
+static void validate_raster(struct wsk_seat *seat, struct wsk_raster *raster) {
+	const struct wsk_state *state = seat->state;
+	if (raster->layout && raster->style == state->style
+			&& raster->labels_generation == seat->labels.generation) {
+		return;
 	}
-	cairo_set_font_options(cairo, fo);
-	cairo_font_options_destroy(fo);
-	cairo_save(cairo);
-	cairo_set_operator(cairo, CAIRO_OPERATOR_CLEAR);
-	cairo_paint(cairo);
-	cairo_restore(cairo);
-
-	const int scale = state->output ? state->output->scale : 1;
-	uint32_t width = 0, height = 0;
-	render_to_cairo(cairo, state, scale, &width, &height);
-	if (height / scale != state->height
-			|| width / scale != state->width
-			|| state->width == 0) {
+
+	// Tiles are redrawn as they are needed again; their pixels are reused
+	for (int i = 0; i < 2; ++i) {
+		for (size_t label = 0; label < raster->ntiles; ++label) {
+			raster->tiles[i][label].height = 0;
+		}
+	}
+	// The background or the quality setting may call for other font options
+	const enum wsk_quality quality = choose_quality(state, raster->subpixel);
+	if (raster->layout && raster->quality != quality) {
+		g_object_unref(raster->layout);
+		raster->layout = NULL;
+		glyph_cache_finish(&raster->glyphs);
+	}
+	if (!raster->layout) {
+		cairo_font_options_t *fo = create_font_options(quality,
+				to_cairo_subpixel_order(raster->subpixel));
+		raster->layout = create_label_layout(&state->pango_font,
+				raster->scale, fo);
+		cairo_font_options_destroy(fo);
+		raster->quality = quality;
+		glyph_cache_init(&raster->glyphs, raster->layout);
+		raster->glyphs.budget =
+			state->memory_budget ? WSK_BUDGET_GLYPH_BYTES : 0;
+		// One line height for every label, so tiles stack into lines
+		label_line_metrics(raster->layout, state->label_corpus,
+				&raster->line_height, &raster->baseline);
+	}
+	raster->style = state->style;
+	raster->labels_generation = seat->labels.generation;
+	raster->drawn = false;
+	++seat->warmups;
+}
+
+static bool same_key(const struct wsk_keypress *a,
+		const struct wsk_keypress *b) {
+	return a->label == b->label && a->count == b->count
+		&& a->flags == b->flags;
+}
+
+static uint32_t draw_key(struct wsk_seat *seat, struct wsk_raster *raster,
+		const struct wsk_keypress *key, uint32_t x, uint32_t y) {
+	uint16_t tiles[WSK_KEY_TILES];
+	bool special[WSK_KEY_TILES];
+	const size_t n = key_tiles(seat, key, tiles, special);
+	for (size_t i = 0; i < n; ++i) {
+		const struct wsk_image *tile = get_tile(seat, raster, tiles[i],
+				special[i]);
+		image_blit(&raster->image, x, y, tile);
+		x += tile->width;
+	}
+	return x;
+}
+
+/* Moves the pixels of the keys a line starts with, if the last frame drew
+ * them too, to where they belong now. Returns how many keys it placed. */
+static size_t reuse_keys(struct wsk_seat *seat, struct wsk_raster *raster,
+		size_t line, uint64_t drop, uint32_t *x) {
+	const size_t first = seat->line_first[line];
+	const size_t end = line + 1 < seat->nlines ?
+		seat->line_first[line + 1] : seat->nkeys;
+	if (!raster->drawn || first + drop >= raster->nshown) {
+		return 0;
+	}
+
+	// The line the first key was drawn on, and where on it
+	const size_t old = first + drop;
+	size_t old_line = raster->nshown_lines - 1;
+	while (raster->shown_first[old_line] > old) {
+		--old_line;
+	}
+	// Lines above this one have been redrawn already
+	if (old_line < line) {
+		return 0;
+	}
+	const size_t old_end = old_line + 1 < raster->nshown_lines ?
+		raster->shown_first[old_line + 1] : raster->nshown;
+	uint32_t old_x = 0;
+	for (size_t i = raster->shown_first[old_line]; i < old; ++i) {
+		old_x += key_width(seat, raster, &raster->shown[i]);
+	}
+
+	size_t i = first;
+	uint32_t width = 0;
+	while (i < end && i + drop < old_end
+			&& same_key(&seat->keys[i], &raster->shown[i + drop])) {
+		width += key_width(seat, raster, &seat->keys[i]);
+		++i;
+	}
+	if (width && (old_x || old_line != line)) {
+		image_move(&raster->image, 0, line * raster->line_height,
+				old_x, old_line * raster->line_height,
+				width, raster->line_height);
+		++raster->scrolls;
+	}
+	*x = width;
+	return i - first;
+}
+
+static void remember_keys(struct wsk_seat *seat, struct wsk_raster *raster) {
+	if (seat->nkeys > raster->shown_size) {
+		raster->shown_size = seat->keys_size;
+		raster->shown = realloc(raster->shown,
+				raster->shown_size * sizeof(struct wsk_keypress));
+		assert(raster->shown);
+		++seat->warmups;
+	}
+	memcpy(raster->shown, seat->keys, seat->nkeys * sizeof(struct wsk_keypress));
+	memcpy(raster->shown_first, seat->line_first, sizeof(seat->line_first));
+	raster->nshown = seat->nkeys;
+	raster->nshown_lines = seat->nkeys ? seat->nlines : 0;
+	raster->shown_evicted = seat->evicted;
+}
+
+static void render_raster(struct wsk_seat *seat, struct wsk_raster *raster) {
+	const struct wsk_state *state = seat->state;
+	const size_t nlines = seat->nkeys ? seat->nlines : 0;
+	uint32_t width = 0;
+	for (size_t line = 0; line < nlines; ++line) {
+		const size_t end = line + 1 < nlines ?
+			seat->line_first[line + 1] : seat->nkeys;
+		uint32_t line_width = 0;
+		for (size_t i = seat->line_first[line]; i < end; ++i) {
+			line_width += key_width(seat, raster, &seat->keys[i]);
+		}
+		if (line_width > width) {
+			width = line_width;
+		}
+	}
+	const uint32_t height = width ? nlines * raster->line_height : 0;
+	if (image_resize(&raster->image, width, height)) {
+		++seat->warmups;
+		raster->drawn = false;
+	}
+	raster->full_redraws += !raster->drawn && width;
+
+	// Keys that were drawn last frame keep their pixels, scrolled into
+	// place; only the keys after them are drawn from tiles
+	const uint64_t drop = seat->evicted - raster->shown_evicted;
+	const uint32_t background = image_pixel(state->background);
+	for (size_t line = 0; width && line < nlines; ++line) {
+		const size_t end = line + 1 < nlines ?
+			seat->line_first[line + 1] : seat->nkeys;
+		const uint32_t y = line * raster->line_height;
+		uint32_t x = 0;
+		size_t i = seat->line_first[line]
+			+ reuse_keys(seat, raster, line, drop, &x);
+		for (; i < end; ++i) {
+			x = draw_key(seat, raster, &seat->keys[i], x, y);
+		}
+		image_fill(&raster->image, x, y, width - x,
+				raster->line_height, background);
+	}
+	remember_keys(seat, raster);
+	raster->drawn = true;
+	raster->frame = state->frame;
+}
+
+static void destroy_raster(struct wsk_raster *raster) {
+	image_finish(&raster->image);
+	free(raster->shown);
+	for (int i = 0; i < 2; ++i) {
+		for (size_t label = 0; label < raster->ntiles; ++label) {
+			image_finish(&raster->tiles[i][label]);
+		}
+		free(raster->tiles[i]);
+	}
+	if (raster->layout) {
+		g_object_unref(raster->layout);
+	}
+	glyph_cache_finish(&raster->glyphs);
+	free(raster);
+}
+
+static void surface_buffer_release(void *data) {
+	struct wsk_surface *surface = data;
+	// Both buffers were busy at the last frame, so this one catches up
+	if (!surface->shown) {
+		set_dirty(surface->seat);
+	}
+}
+
+/* False when nothing could be committed and the surface is still stale */
+static bool render_surface(struct wsk_surface *surface,
+		const struct wsk_raster *raster) {
+	const struct wsk_state *state = surface->seat->state;
+	const int scale = raster->scale;
+	const uint32_t width = raster->image.width, height = raster->image.height;
+
+	if (height / scale != surface->height
+			|| width / scale != surface->width
+			|| surface->width == 0) {
 		// Reconfigure surface
 		if (width == 0 || height == 0) {
-			wl_surface_attach(state->surface, NULL, 0, 0);
+			if (!surface->configured) {
+				return true;
+			}
+			wl_surface_attach(surface->surface, NULL, 0, 0);
+			// Unmapped layer surfaces must be configured again
+			surface->configured = false;
+			surface->width = surface->height = 0;
 		} else {
 			zwlr_layer_surface_v1_set_size(
-					state->layer_surface, width / scale, height / scale);
+					surface->layer_surface, width / scale, height / scale);
 		}
 
 		// TODO: this could infinite loop if the compositor assigns us a
 		// different height than what we asked for
-		wl_surface_commit(state->surface);
+		wl_surface_commit(surface->surface);
+		WSK_TRACE4(commit, trace_now(), width / scale, height / scale, 0);
 	} else if (height > 0) {
-		// Replay recording into shm and send it off
-		state->current_buffer = get_next_buffer(state->shm,
-				state->buffers, state->width * scale, state->height * scale);
-		if (!state->current_buffer) {
-			cairo_surface_destroy(recorder);
-			cairo_destroy(cairo);
-			return;
+		// Copy the shared raster into shm and send it off
+		const uint32_t buffer_width = surface->width * scale;
+		const uint32_t buffer_height = surface->height * scale;
+		surface->current_buffer = get_next_buffer(state->shm,
+				surface->buffers, buffer_width, buffer_height,
+				choose_shm_format(state));
+		if (!surface->current_buffer) {
+			return false;
 		}
-		cairo_t *shm = state->current_buffer->cairo;
+		struct pool_buffer *buffer = surface->current_buffer;
+		buffer->release = surface_buffer_release;
+		buffer->release_data = surface;
+		buffer_write(buffer, (const unsigned char *)raster->image.pixels,
+				raster->image.stride * sizeof(uint32_t), width, height);
+		++surface->frames;
+		surface->bytes_uploaded += buffer->size;
+
+		wl_surface_set_buffer_scale(surface->surface, scale);
+		wl_surface_attach(surface->surface, buffer->buffer, 0, 0);
+		wl_surface_damage_buffer(surface->surface, 0, 0,
+				buffer_width, buffer_height);
+		wl_surface_commit(surface->surface);
+		WSK_TRACE4(commit, trace_now(),
+				buffer_width, buffer_height, buffer->size);
+	}
+	return true;
+}
 
-		cairo_save(shm);
-		cairo_set_operator(shm, CAIRO_OPERATOR_CLEAR);
-		cairo_paint(shm);
-		cairo_restore(shm);
+static uint32_t choose_shm_format(const struct wsk_state *state) {
+	if ((state->background & 0xFF) != 0xFF) {
+		return WL_SHM_FORMAT_ARGB8888;
+	}
+	// Opaque: no alpha to blend. Like ARGB8888, every wl_shm has it. RGB888
+	// would upload a quarter less, but repacking it costs us and most
+	// compositors far more than that saves (see wsk-bench-formats)
+	return WL_SHM_FORMAT_XRGB8888;
+}
 
-		cairo_set_source_surface(shm, recorder, 0.0, 0.0);
-		cairo_paint(shm);
+static void render_frame(struct wsk_seat *seat) {
+	const uint64_t style = seat->state->style;
+	const uint64_t frame = ++seat->state->frame;
+	WSK_TRACE3(render_start, trace_now(), frame, seat->generation);
+	for (struct wsk_surface *surface = seat->surfaces;
+			surface; surface = surface->next) {
+		if (surface->shown && surface->shown_generation == seat->generation
+				&& surface->shown_style == style) {
+			// Nothing it shows has changed since its last commit
+			++surface->skipped;
+			continue;
+		}
+		struct wsk_raster *raster = get_raster(seat, surface->output);
+		if (raster->frame != frame) {
+			render_raster(seat, raster);
+		}
+		// What libwayland allocates to send requests is not ours to count
+		const bool tracking = alloc_track_suspend();
+		surface->shown = render_surface(surface, raster);
+		alloc_track_resume(tracking);
+		surface->shown_generation = seat->generation;
+		surface->shown_style = style;
+	}
+	WSK_TRACE3(render_end, trace_now(), frame, seat->nkeys);
+}
 
-		wl_surface_set_buffer_scale(state->surface, scale);
-		wl_surface_attach(state->surface,
-				state->current_buffer->buffer, 0, 0);
-		wl_surface_damage_buffer(state->surface, 0, 0,
-				state->width, state->height);
-		wl_surface_commit(state->surface);
+/* Renders right away; render_frame skips surfaces that are up to date */
+static void set_dirty(struct wsk_seat *seat) {
+	if (seat->surfaces) {
+		render_frame(seat);
 	}
 }
 
-static void set_dirty(struct wsk_state *state) {
-	if (state->frame_scheduled) {
-		state->dirty = true;
-	} else if (state->surface) {
-		render_frame(state);
+static uint64_t seat_warmups(const struct wsk_seat *seat) {
+	// A new label or a longer history may allocate too
+	return seat->warmups + seat->labels.count + seat->keys_size
+		+ seat->compose.warmups;
+}
+
+static void check_allocs(struct wsk_seat *seat,
+		uint64_t allocs, uint64_t warmups) {
+	seat->allocs += allocs;
+	if (seat_warmups(seat) != warmups) {
+		++seat->warm_frames;
+		return;
 	}
+	++seat->steady_frames;
+	// With every cache warm, a keystroke must not touch the heap
+	assert(allocs == 0);
 }
 
 static void layer_surface_configure(void *data,
 			struct zwlr_layer_surface_v1 *zwlr_layer_surface_v1,
 			uint32_t serial, uint32_t width, uint32_t height) {
-	struct wsk_state *state = data;
-	state->width = width;
-	state->height = height;
+	struct wsk_surface *surface = data;
+	surface->width = width;
+	surface->height = height;
+	surface->configured = true;
+	surface->shown = false;
 	zwlr_layer_surface_v1_ack_configure(zwlr_layer_surface_v1, serial);
-	set_dirty(state);
+	set_opaque_region(surface);
+	set_dirty(surface->seat);
 }
 
 static void layer_surface_closed(void *data,
 		struct zwlr_layer_surface_v1 *zwlr_layer_surface_v1) {
-	struct wsk_state *state = data;
-	state->run = false;
+	struct wsk_surface *surface = data;
+	struct wsk_state *state = surface->seat->state;
+	destroy_surface(surface);
+	if (!state->output_names) {
+		state->run = false;
+	}
 }
 
 static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
@@ -242,12 +685,17 @@ static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
 
 static void surface_enter(void *data,
 		struct wl_surface *wl_surface, struct wl_output *output) {
-	struct wsk_state *state = data;
-	struct wsk_output *wsk_output = state->outputs;
-	while (wsk_output->output != output) {
+	struct wsk_surface *surface = data;
+	struct wsk_output *wsk_output = surface->seat->state->outputs;
+	while (wsk_output && wsk_output->output != output) {
 		wsk_output = wsk_output->next;
 	}
-	state->output = wsk_output;
+	if (wsk_output && !surface->output) {
+		surface->output = wsk_output;
+		// Possibly a different scale
+		surface->shown = false;
+		set_dirty(surface->seat);
+	}
 }
 
 static void surface_leave(void *data,
@@ -262,7 +710,8 @@ static const struct wl_surface_listener wl_surface_listener = {
 
 static void keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
 		uint32_t format, int32_t fd, uint32_t size) {
-	struct wsk_state *state = data;
+	struct wsk_seat *seat = data;
+	struct wsk_state *state = seat->state;
 
 	// 🔥 크기 체크
     if (size == 0) {
@@ -277,16 +726,7 @@ static void keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
             return;
         }
 
-        struct xkb_state *xkb_state = xkb_state_new(keymap);
-        if (!xkb_state) {
-            xkb_keymap_unref(keymap);
-            return;
-        }
-
-        xkb_keymap_unref(state->xkb_keymap);
-        xkb_state_unref(state->xkb_state);
-        state->xkb_keymap = keymap;
-        state->xkb_state = xkb_state;
+        seat_set_keymap(seat, keymap, NULL);
         return;
     }
 
@@ -302,17 +742,17 @@ static void keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
 		return;
 	}
 
-	struct xkb_keymap *keymap = xkb_keymap_new_from_string(
-			state->xkb_context, map_shm, XKB_KEYMAP_FORMAT_TEXT_V1,
-			XKB_KEYMAP_COMPILE_NO_FLAGS);
+	const struct wsk_labels *labels;
+	struct xkb_keymap *keymap = keymap_cache_get(&state->keymap_cache,
+			state->xkb_context, &state->symbols, map_shm, size, &labels);
 	munmap(map_shm, size);
 	close(fd);
+	if (!keymap) {
+		fprintf(stderr, "Failed to compile keymap\n");
+		return;
+	}
 
-	struct xkb_state *xkb_state = xkb_state_new(keymap);
-	xkb_keymap_unref(state->xkb_keymap);
-	xkb_state_unref(state->xkb_state);
-	state->xkb_keymap = keymap;
-	state->xkb_state = xkb_state;
+	seat_set_keymap(seat, keymap, labels);
 }
 
 static void keyboard_enter(void *data, struct wl_keyboard *wl_keyboard,
@@ -352,30 +792,63 @@ static const struct wl_keyboard_listener wl_keyboard_listener = {
 
 static void seat_capabilities(
 		void *data, struct wl_seat *wl_seat, uint32_t capabilities) {
-	struct wsk_state *state = data;
-	if (state->keyboard) {
-		// TODO: support multiple seats
-		return;
+	struct wsk_seat *seat = data;
+	const bool keyboard = capabilities & WL_SEAT_CAPABILITY_KEYBOARD;
+	if (keyboard && !seat->keyboard) {
+		seat->keyboard = wl_seat_get_keyboard(wl_seat);
+		wl_keyboard_add_listener(seat->keyboard, &wl_keyboard_listener, seat);
+	} else if (!keyboard && seat->keyboard) {
+		wl_keyboard_release(seat->keyboard);
+		seat->keyboard = NULL;
 	}
+}
 
-	if (!(capabilities & WL_SEAT_CAPABILITY_KEYBOARD)) {
-		fprintf(stderr, "wl_seat does not support keyboard");
-		state->run = false;
+static bool seat_reads_input(const struct wsk_seat *seat) {
+	return seat->libinput || seat == seat->state->replay_seat;
+}
+
+static void seat_name(void *data, struct wl_seat *wl_seat, const char *name) {
+	struct wsk_seat *seat = data;
+	struct wsk_state *state = seat->state;
+	if (seat_reads_input(seat)) {
+		return;
+	}
+	free(seat->name);
+	seat->name = strdup(name);
+
+	if (state->replay_path) {
+		// The whole replay goes to the first seat
+		if (!state->replay_seat) {
+			state->replay_seat = seat;
+			fprintf(stdout, "Replaying %s on seat %s\n",
+					state->replay_path, name);
+			seat_create_surfaces(seat);
+		}
 		return;
 	}
 
-	state->keyboard = wl_seat_get_keyboard(wl_seat);
-	wl_keyboard_add_listener(state->keyboard, &wl_keyboard_listener, state);
-}
+	if (state->spare_libinput && strcmp(name, "seat0") == 0) {
+		seat->libinput = state->spare_libinput;
+		state->spare_libinput = NULL;
+		fprintf(stdout, "Reading input for seat %s\n", name);
+		seat_create_surfaces(seat);
+		return;
+	}
 
-static void seat_name(void *data, struct wl_seat *wl_seat, const char *name) {
-	struct wsk_state *state = data;
-	/* TODO: support multiple seats */
-	if (libinput_udev_assign_seat(state->libinput, "seat0") != 0) {
-		fprintf(stderr, "Failed to assign libinput seat\n");
-		state->run = false;
+	seat->libinput = libinput_udev_create_context(
+			&libinput_impl, &state->devmgr, state->udev);
+	if (!seat->libinput) {
+		fprintf(stderr, "libinput_udev_create_context: %s\n", strerror(errno));
+		return;
+	}
+	if (libinput_udev_assign_seat(seat->libinput, name) != 0) {
+		fprintf(stderr, "Failed to assign libinput seat %s\n", name);
+		libinput_unref(seat->libinput);
+		seat->libinput = NULL;
 		return;
 	}
+	fprintf(stdout, "Reading input for seat %s\n", name);
+	seat_create_surfaces(seat);
 }
 
 static const struct wl_seat_listener wl_seat_listener = {
@@ -393,11 +866,10 @@ static void output_geometry(void *data, struct wl_output *wl_output,
 
 static void output_mode(void *data, struct wl_output *wl_output,
 		uint32_t flags, int32_t width, int32_t height, int32_t refresh) {
-	// 🔥 실제 화면 크기 저장
+	// In physical pixels; line widths use the logical size from xdg-output
 	struct wsk_output *output = data;
 	output->width = width;
 	output->heigh = height;
-	fprintf(stdout, "Screen resolution: %dx%d\n", width, height);
 }
 
 static void output_done(void *data, struct wl_output *wl_output) {
@@ -417,6 +889,447 @@ static const struct wl_output_listener wl_output_listener = {
 	.scale = output_scale,
 };
 
+static void xdg_output_logical_position(void *data,
+		struct zxdg_output_v1 *xdg_output, int32_t x, int32_t y) {
+	// Who cares
+}
+
+static void xdg_output_logical_size(void *data,
+		struct zxdg_output_v1 *xdg_output, int32_t width, int32_t height) {
+	struct wsk_output *output = data;
+	output->logical_width = width;
+	output->logical_height = height;
+}
+
+static void xdg_output_done(void *data, struct zxdg_output_v1 *xdg_output) {
+	struct wsk_output *output = data;
+	struct wsk_state *state = output->state;
+	if (!output_is_selected(state, output)) {
+		return;
+	}
+	for (struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+		if (seat_reads_input(seat)) {
+			seat_create_surfaces(seat);
+		}
+	}
+}
+
+static void xdg_output_name(void *data,
+		struct zxdg_output_v1 *xdg_output, const char *name) {
+	struct wsk_output *output = data;
+	free(output->name);
+	output->name = strdup(name);
+}
+
+static void xdg_output_description(void *data,
+		struct zxdg_output_v1 *xdg_output, const char *description) {
+	// Who cares
+}
+
+static const struct zxdg_output_v1_listener xdg_output_listener = {
+	.logical_position = xdg_output_logical_position,
+	.logical_size = xdg_output_logical_size,
+	.done = xdg_output_done,
+	.name = xdg_output_name,
+	.description = xdg_output_description,
+};
+
+static struct wsk_surface *create_surface(struct wsk_seat *seat,
+		struct wsk_output *output) {
+	const struct wsk_state *state = seat->state;
+	struct wsk_surface *surface = calloc(1, sizeof(struct wsk_surface));
+	assert(surface);
+	surface->seat = seat;
+	surface->output = output;
+	surface->pinned = output != NULL;
+
+	surface->surface = wl_compositor_create_surface(state->compositor);
+	assert(surface->surface);
+	surface->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
+			state->layer_shell, surface->surface,
+			output ? output->output : NULL,
+			ZWLR_LAYER_SHELL_V1_LAYER_TOP, "showkeys");
+	assert(surface->layer_surface);
+
+	wl_surface_add_listener(surface->surface, &wl_surface_listener, surface);
+	zwlr_layer_surface_v1_add_listener(
+			surface->layer_surface, &layer_surface_listener, surface);
+	zwlr_layer_surface_v1_set_size(surface->layer_surface, 1, 1);
+	place_surface(surface);
+	zwlr_layer_surface_v1_set_exclusive_zone(surface->layer_surface, -1);
+
+	// Clicks go through to whatever is below
+	struct wl_region *input = wl_compositor_create_region(state->compositor);
+	wl_surface_set_input_region(surface->surface, input);
+	wl_region_destroy(input);
+	wl_surface_commit(surface->surface);
+
+	struct wsk_surface **link = &seat->surfaces;
+	while (*link) {
+		link = &(*link)->next;
+	}
+	*link = surface;
+	return surface;
+}
+
+static void set_opaque_region(struct wsk_surface *surface) {
+	// Lets the compositor skip blending whatever is underneath
+	const struct wsk_state *state = surface->seat->state;
+	if ((state->background & 0xFF) != 0xFF) {
+		wl_surface_set_opaque_region(surface->surface, NULL);
+		return;
+	}
+	struct wl_region *opaque = wl_compositor_create_region(state->compositor);
+	wl_region_add(opaque, 0, 0, surface->width, surface->height);
+	wl_surface_set_opaque_region(surface->surface, opaque);
+	wl_region_destroy(opaque);
+}
+
+static void destroy_surface(struct wsk_surface *surface) {
+	struct wsk_surface **link = &surface->seat->surfaces;
+	while (*link != surface) {
+		link = &(*link)->next;
+	}
+	*link = surface->next;
+
+	destroy_buffer(&surface->buffers[0]);
+	destroy_buffer(&surface->buffers[1]);
+	zwlr_layer_surface_v1_destroy(surface->layer_surface);
+	wl_surface_destroy(surface->surface);
+	free(surface);
+}
+
+static void seat_create_surfaces(struct wsk_seat *seat) {
+	const struct wsk_state *state = seat->state;
+	if (!state->output_names) {
+		if (!seat->surfaces) {
+			create_surface(seat, NULL);
+		}
+		return;
+	}
+
+	for (struct wsk_output *output = state->outputs;
+			output; output = output->next) {
+		if (!output_is_selected(state, output)) {
+			continue;
+		}
+		const struct wsk_surface *surface = seat->surfaces;
+		while (surface && !(surface->pinned && surface->output == output)) {
+			surface = surface->next;
+		}
+		if (!surface) {
+			fprintf(stdout, "Showing keys of %s on output %s\n",
+					seat->name, output->name);
+			create_surface(seat, output);
+		}
+	}
+}
+
+static void clear_keys(struct wsk_seat *seat) {
+	if (!seat->nkeys) {
+		return;
+	}
+	seat->evicted += seat->nkeys;
+	++seat->generation;
+	WSK_TRACE3(trim, trace_now(), seat->nkeys, 0);
+	seat->nkeys = 0;
+	seat->nlines = 1;
+	seat->line_first[0] = 0;
+}
+
+/* prefill holds the keymap's labels when the keymap cache has them */
+static void seat_set_keymap(struct wsk_seat *seat, struct xkb_keymap *keymap,
+		const struct wsk_labels *prefill) {
+	struct xkb_state *xkb_state = xkb_state_new(keymap);
+	if (!xkb_state) {
+		xkb_keymap_unref(keymap);
+		return;
+	}
+	xkb_keymap_unref(seat->xkb_keymap);
+	xkb_state_unref(seat->xkb_state);
+	seat->xkb_keymap = keymap;
+	seat->xkb_state = xkb_state;
+
+	// Labels of the previous keymap stay while they are on screen
+	if (!seat->nkeys) {
+		labels_reset(&seat->labels);
+	}
+	if (prefill) {
+		labels_intern_all(&seat->labels, prefill);
+	} else {
+		labels_prefill(&seat->labels, keymap, &seat->state->symbols);
+	}
+	static const char *const count_parts[WSK_COUNT_LABELS] = {
+		"0", "1", "2", "3", "4", "5", "6", "7", "8", "9", " x", " ",
+	};
+	for (size_t i = 0; i < WSK_COUNT_LABELS; ++i) {
+		seat->count_labels[i] = labels_intern(&seat->labels, count_parts[i]);
+	}
+	stats_set_keymap(&seat->stats, keymap);
+}
+
+static void dump_stats(const struct wsk_state *state) {
+	for (const struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+		fprintf(stdout, "Seat %s: %zu of %zu history entries in use, "
+				"%zu bytes each\n", seat->name ? seat->name : "(unnamed)",
+				seat->nkeys, seat->keys_size, sizeof(struct wsk_keypress));
+		fprintf(stdout, "Seat %s: %u labels, %zu of %zu arena bytes used, "
+				"%zu bytes with index\n", seat->name ? seat->name : "(unnamed)",
+				seat->labels.count, seat->labels.arena_len,
+				seat->labels.arena_size, labels_memory(&seat->labels));
+		fprintf(stdout, "Seat %s: %llu key events folded, %llu dropped\n",
+				seat->name ? seat->name : "(unnamed)",
+				(unsigned long long)seat->folded,
+				(unsigned long long)seat->dropped);
+		if (seat->compose.state) {
+			fprintf(stdout, "Seat %s: %llu compose sequences finished, "
+					"%llu cancelled\n", seat->name ? seat->name : "(unnamed)",
+					(unsigned long long)seat->compose.composed,
+					(unsigned long long)seat->compose.cancelled);
+		}
+#ifdef WSK_ALLOC_STATS
+		fprintf(stdout, "Seat %s: %llu allocations on the keystroke path, "
+				"%llu batches warming caches, %llu steady\n",
+				seat->name ? seat->name : "(unnamed)",
+				(unsigned long long)seat->allocs,
+				(unsigned long long)seat->warm_frames,
+				(unsigned long long)seat->steady_frames);
+#endif
+		for (const struct wsk_raster *raster = seat->rasters;
+				raster; raster = raster->next) {
+			size_t ntiles = 0, bytes = image_memory(&raster->image);
+			for (int i = 0; i < 2; ++i) {
+				for (size_t label = 0; label < raster->ntiles; ++label) {
+					ntiles += raster->tiles[i][label].height != 0;
+					bytes += image_memory(&raster->tiles[i][label]);
+				}
+			}
+			fprintf(stdout, "Seat %s: raster at scale %d: %s quality, "
+					"%zu label tiles (%llu evicted), %zu pixel bytes, "
+					"%llu full redraws, %llu scrolls\n",
+					seat->name ? seat->name : "(unnamed)",
+					raster->scale, quality_name(raster->quality), ntiles,
+					(unsigned long long)raster->tiles_evicted, bytes,
+					(unsigned long long)raster->full_redraws,
+					(unsigned long long)raster->scrolls);
+			const struct wsk_glyph_cache *glyphs = &raster->glyphs;
+			fprintf(stdout, "Seat %s: raster at scale %d: %zu glyphs in "
+					"%zu bytes, %llu hits, %llu misses, %llu flushes, "
+					"%llu labels drawn by Pango\n",
+					seat->name ? seat->name : "(unnamed)",
+					raster->scale, glyphs->count, glyph_cache_memory(glyphs),
+					(unsigned long long)glyphs->hits,
+					(unsigned long long)glyphs->misses,
+					(unsigned long long)glyphs->flushes,
+					(unsigned long long)glyphs->fallbacks);
+		}
+		for (const struct wsk_surface *surface = seat->surfaces;
+				surface; surface = surface->next) {
+			const struct pool_buffer *buffer = surface->current_buffer;
+			fprintf(stdout, "Seat %s: surface on %s: %llu frames "
+					"(%llu skipped unchanged), "
+					"%llu bytes uploaded (%llu per frame), %s\n",
+					seat->name ? seat->name : "(unnamed)",
+					surface->output && surface->output->name ?
+						surface->output->name : "(any output)",
+					(unsigned long long)surface->frames,
+					(unsigned long long)surface->skipped,
+					(unsigned long long)surface->bytes_uploaded,
+					(unsigned long long)(surface->frames ?
+						surface->bytes_uploaded / surface->frames : 0),
+					buffer ? shm_format_name(buffer->format) : "no buffer");
+		}
+		char name[64];
+		snprintf(name, sizeof(name), "Seat %s",
+				seat->name ? seat->name : "(unnamed)");
+		latency_report(&seat->latency, name, stdout);
+	}
+	fprintf(stdout, "Keymaps: %u compiled in %.1f ms, %u cache hits\n",
+			state->keymap_cache.compiles, state->keymap_cache.compile_ms,
+			state->keymap_cache.hits);
+	fprintf(stdout, "Low-latency mode %s. ", state->low_latency ? "on" : "off");
+	latency_report_process(stdout);
+	struct rusage usage = { 0 };
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(stdout, "Memory budget %s: %zu KiB resident, %ld KiB peak\n",
+			state->memory_budget ? "on" : "off",
+			resident_bytes() / 1024, usage.ru_maxrss);
+}
+
+static size_t resident_bytes(void) {
+	FILE *f = fopen("/proc/self/statm", "r");
+	unsigned long pages = 0;
+	if (f) {
+		if (fscanf(f, "%*u %lu", &pages) != 1) {
+			pages = 0;
+		}
+		fclose(f);
+	}
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+static void send_memory(struct wsk_state *state,
+		struct wsk_ipc_client *client) {
+	struct rusage usage = { 0 };
+	getrusage(RUSAGE_SELF, &usage);
+	ipc_printf(client, "{\"budget\":%s,\"rss\":%zu,\"peak_rss\":%ld,"
+			"\"seats\":[", state->memory_budget ? "true" : "false",
+			resident_bytes(), usage.ru_maxrss * 1024);
+	for (struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+		ipc_printf(client, "%s{\"name\":", seat == state->seats ? "" : ",");
+		ipc_reply_json(client, seat->name ? seat->name : "");
+		ipc_printf(client, ",\"history\":%zu,\"labels\":%zu,\"rasters\":[",
+				seat->keys_size * sizeof(struct wsk_keypress),
+				labels_memory(&seat->labels));
+		for (struct wsk_raster *raster = seat->rasters;
+				raster; raster = raster->next) {
+			ipc_printf(client, "%s{\"scale\":%d,\"image\":%zu,"
+					"\"tiles\":%zu,\"glyphs\":%zu}",
+					raster == seat->rasters ? "" : ",", raster->scale,
+					image_memory(&raster->image), raster->tile_bytes,
+					glyph_cache_memory(&raster->glyphs));
+		}
+		ipc_printf(client, "]}");
+	}
+	ipc_printf(client, "]}\n");
+}
+
+static uint64_t monotonic_us(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+}
+
+/* Feeds the replayed events that are due as one input batch */
+static void replay_keys(struct wsk_seat *seat, struct wsk_replay *replay) {
+	const uint64_t warmups = seat_warmups(seat);
+	alloc_track_begin();
+	struct wsk_replay_event event;
+	bool any = false;
+	while (replay_next(replay, monotonic_us(), &event)) {
+		handle_key(seat, event.key, event.pressed ?
+				LIBINPUT_KEY_STATE_PRESSED : LIBINPUT_KEY_STATE_RELEASED,
+				event.at_us);
+		any = true;
+	}
+	if (!any) {
+		alloc_track_end();
+		return;
+	}
+	flush_key_events(seat);
+	check_allocs(seat, alloc_track_end(), warmups);
+}
+
+/* Called once the frames drawn for the last input batches are sent */
+static void record_latency(struct wsk_state *state) {
+	const uint64_t now_us = monotonic_us();
+	for (struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+		if (seat->batch_us) {
+			latency_record(&seat->latency,
+					now_us > seat->batch_us ? now_us - seat->batch_us : 0);
+			seat->batch_us = 0;
+		}
+	}
+}
+
+static void destroy_seat(struct wsk_seat *seat) {
+	struct wsk_seat **link = &seat->state->seats;
+	while (*link != seat) {
+		link = &(*link)->next;
+	}
+	*link = seat->next;
+	if (seat->state->replay_seat == seat) {
+		seat->state->replay_seat = NULL;
+	}
+
+	while (seat->surfaces) {
+		destroy_surface(seat->surfaces);
+	}
+	while (seat->rasters) {
+		struct wsk_raster *next = seat->rasters->next;
+		destroy_raster(seat->rasters);
+		seat->rasters = next;
+	}
+	free(seat->keys);
+	labels_finish(&seat->labels);
+	compose_finish(&seat->compose);
+	if (seat->keyboard) {
+		wl_keyboard_release(seat->keyboard);
+	}
+	if (seat->libinput) {
+		libinput_unref(seat->libinput);
+	}
+	xkb_state_unref(seat->xkb_state);
+	xkb_keymap_unref(seat->xkb_keymap);
+	wl_seat_release(seat->wl_seat);
+	free(seat->name);
+	free(seat);
+}
+
+static bool output_is_selected(const struct wsk_state *state,
+		const struct wsk_output *output) {
+	if (!output->name) {
+		return false;
+	}
+	for (size_t i = 0; i < state->n_output_names; ++i) {
+		if (strcmp(state->output_names[i], output->name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void output_init_xdg(struct wsk_state *state, struct wsk_output *output) {
+	if (output->xdg_output || !state->output_mgr) {
+		return;
+	}
+	output->xdg_output = zxdg_output_manager_v1_get_xdg_output(
+			state->output_mgr, output->output);
+	zxdg_output_v1_add_listener(output->xdg_output,
+			&xdg_output_listener, output);
+}
+
+static void destroy_output(struct wsk_output *output) {
+	struct wsk_state *state = output->state;
+	struct wsk_output **link = &state->outputs;
+	while (*link != output) {
+		link = &(*link)->next;
+	}
+	*link = output->next;
+
+	for (struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+		struct wsk_surface *surface = seat->surfaces;
+		while (surface) {
+			struct wsk_surface *next = surface->next;
+			if (surface->output == output && surface->pinned) {
+				destroy_surface(surface);
+			} else if (surface->output == output) {
+				surface->output = NULL;
+				surface->shown = false;
+			}
+			surface = next;
+		}
+	}
+	if (output->xdg_output) {
+		zxdg_output_v1_destroy(output->xdg_output);
+	}
+	wl_output_release(output->output);
+	free(output->name);
+	free(output);
+}
+
+static bool surfaces_configured(const struct wsk_state *state) {
+	for (const struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+		for (const struct wsk_surface *surface = seat->surfaces;
+				surface; surface = surface->next) {
+			if (!surface->configured) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
 static void registry_global(void *data, struct wl_registry *wl_registry,
 		uint32_t name, const char *interface, uint32_t version) {
 	struct wsk_state *state = data;
@@ -426,16 +1339,31 @@ static void registry_global(void *data, struct wl_registry *wl_registry,
 	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
 		state->shm = wl_registry_bind(wl_registry, name, &wl_shm_interface, 1);
 	} else if (strcmp(interface, wl_seat_interface.name) == 0) {
-		state->seat = wl_registry_bind(wl_registry,
+		struct wsk_seat *seat = calloc(1, sizeof(struct wsk_seat));
+		assert(seat);
+		seat->state = state;
+		seat->global = name;
+		seat->nlines = 1;
+		seat->wl_seat = wl_registry_bind(wl_registry,
 				name, &wl_seat_interface, 5);
+		struct wsk_seat **link = &state->seats;
+		while (*link) {
+			link = &(*link)->next;
+		}
+		*link = seat;
+		wl_seat_add_listener(seat->wl_seat, &wl_seat_listener, seat);
 	} else if (strcmp(interface, zxdg_output_manager_v1_interface.name) == 0) {
 		state->output_mgr = wl_registry_bind(wl_registry,
-				name, &zxdg_output_manager_v1_interface, 1);
+				name, &zxdg_output_manager_v1_interface,
+				version < 2 ? version : 2);
 	} else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0) {
 		state->layer_shell = wl_registry_bind(wl_registry,
 				name, &zwlr_layer_shell_v1_interface, 1);
 	} else if (strcmp(interface, wl_output_interface.name) == 0) {
 		struct wsk_output *output = calloc(1, sizeof(struct wsk_output));
+		assert(output);
+		output->state = state;
+		output->global = name;
 		output->output = wl_registry_bind(wl_registry,
 				name, &wl_output_interface, 3);
 		output->scale = 1; output->heigh = 0; output->width = 0;
@@ -445,18 +1373,32 @@ static void registry_global(void *data, struct wl_registry *wl_registry,
 		}
 		*link = output;
 		wl_output_add_listener(output->output, &wl_output_listener, output);
-
-		// 🔥 첫 번째 output을 기본으로 설정
-    	if (!state->output) {
-    	    state->output = output;
-    	    printf("Set primary output\n");
-    	}
+		output_init_xdg(state, output);
 	}
 }
 
 static void registry_global_remove(void *data,
 		struct wl_registry *wl_registry, uint32_t name) {
-	/* This space deliberately left blank */
+	struct wsk_state *state = data;
+	for (struct wsk_output *output = state->outputs;
+			output; output = output->next) {
+		if (output->global == name) {
+			destroy_output(output);
+			for (struct wsk_seat *seat = state->seats;
+					seat; seat = seat->next) {
+				set_dirty(seat);
+			}
+			return;
+		}
+	}
+	for (struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+		if (seat->global == name) {
+			destroy_seat(seat);
+			// The seats after it move up a slot
+			set_layer_placement(state);
+			return;
+		}
+	}
 }
 
 static const struct wl_registry_listener registry_listener = {
@@ -464,12 +1406,8 @@ static const struct wl_registry_listener registry_listener = {
 	.global_remove = registry_global_remove,
 };
 
-static void handle_libinput_event(struct wsk_state *state,
+static void handle_libinput_event(struct wsk_seat *seat,
 		struct libinput_event *event) {
-	if (!state->xkb_state) {
-		return;
-	}
-
 	const enum libinput_event_type event_type = libinput_event_get_type(event);
 	if (event_type != LIBINPUT_EVENT_KEYBOARD_KEY) {
 		return;
@@ -477,83 +1415,479 @@ static void handle_libinput_event(struct wsk_state *state,
 
 	struct libinput_event_keyboard *kbevent =
 		libinput_event_get_keyboard_event(event);
+	handle_key(seat, libinput_event_keyboard_get_key(kbevent),
+			libinput_event_keyboard_get_key_state(kbevent),
+			libinput_event_keyboard_get_time_usec(kbevent));
+}
+
+/* A key event from libinput or a replay; time_us is CLOCK_MONOTONIC */
+static void handle_key(struct wsk_seat *seat, uint32_t key,
+		enum libinput_key_state key_state, uint64_t time_us) {
+	if (!seat->xkb_state) {
+		return;
+	}
 
-	const uint32_t keycode = libinput_event_keyboard_get_key(kbevent) + 8;
-	const enum libinput_key_state key_state =
-		libinput_event_keyboard_get_key_state(kbevent);
-	xkb_state_update_key(state->xkb_state, keycode,
+	const uint32_t keycode = key + 8;
+	WSK_TRACE4(input, time_us * 1000, trace_now(), key, key_state);
+	xkb_state_update_key(seat->xkb_state, keycode,
 			key_state == LIBINPUT_KEY_STATE_RELEASED ?
 				XKB_KEY_UP : XKB_KEY_DOWN);
 
-	xkb_keysym_t keysym = xkb_state_key_get_one_sym(state->xkb_state, keycode);
+	const xkb_keysym_t keysym =
+		xkb_state_key_get_one_sym(seat->xkb_state, keycode);
+	const bool is_modifier = keysym_is_modifier(keysym);
+	const unsigned int mods = stats_active_mods(&seat->stats, seat->xkb_state);
 
-	struct wsk_keypress *keypress;
-	switch (key_state) {
-	case LIBINPUT_KEY_STATE_RELEASED:
-		/* Who cares */
-		break;
-	case LIBINPUT_KEY_STATE_PRESSED:
+	uint16_t label;
+	bool is_special = true;
+	if (key_state == LIBINPUT_KEY_STATE_RELEASED) {
+		// Modifiers show up on release, unless they were part of a chord
+		if (!is_modifier) {
+			return;
+		}
+		const bool chorded = seat->chorded;
+		if (!mods) {
+			seat->chorded = false;
+		}
+		if (chorded) {
+			return;
+		}
+		label = labels_intern_keysym(&seat->labels,
+				&seat->state->symbols, keysym);
+	} else {
+		stats_record(&seat->stats, seat->xkb_state, keycode - 8, keysym,
+				time_us / 1000);
 		if(keysym == XKB_KEY_Pause || keysym == XKB_KEY_Break) {
-			state->run = false;
+			seat->state->run = false;
+			return;
+		}
+		if (is_modifier) {
+			return;
+		}
+		if (mods) {
+			seat->chorded = true;
+		}
+		// Dead keys and Compose only take Shift along
+		char composed[64];
+		enum wsk_compose_result result = WSK_COMPOSE_PASS;
+		if (mods & ~WSK_STATS_SHIFT) {
+			compose_reset(&seat->compose);
+		} else {
+			result = compose_feed(&seat->compose, &seat->state->compose_table,
+					seat->state->xkb_context, keysym,
+					composed, sizeof(composed));
+		}
+		if (result == WSK_COMPOSE_PENDING) {
 			return;
+		} else if (result == WSK_COMPOSE_DONE && labels_printable(composed)) {
+			is_special = false;
+			label = labels_intern(&seat->labels, composed);
+		} else {
+			label = key_label(seat, keycode, keysym, mods, &is_special);
+		}
+	}
+	if (label == WSK_LABEL_NONE) {
+		return;
+	}
+
+	if (!seat->batch_us) {
+		seat->batch_us = time_us;
+	}
+	queue_key(seat, &(struct wsk_keypress){
+		.time = time_us / 1000,
+		.keysym = keysym,
+		.label = label,
+		.count = 1,
+		.mods = mods,
+		.flags = is_special ? WSK_KEY_SPECIAL : 0,
+	});
+}
+
+static uint16_t key_label(struct wsk_seat *seat, xkb_keycode_t keycode,
+		xkb_keysym_t keysym, unsigned int mods, bool *special) {
+	struct wsk_labels *labels = &seat->labels;
+	const struct wsk_symtab *symbols = &seat->state->symbols;
+
+	// UTF-8 문자 확인
+	char utf8[128];
+	*special = xkb_state_key_get_utf8(seat->xkb_state,
+			keycode, utf8, sizeof(utf8)) <= 0 || !labels_printable(utf8);
+	// Shift on its own just picks the character
+	if (!mods || (mods == WSK_STATS_SHIFT && !*special)) {
+		return *special ? labels_intern_keysym(labels, symbols, keysym) :
+			labels_intern(labels, utf8);
+	}
+
+	// Fold the chord into a single entry, e.g. Ctrl+Shift+T
+	char chord[256];
+	size_t len = 0;
+	for (int i = 0; i < WSK_STATS_MODS; ++i) {
+		if (mods & (1 << i)) {
+			len += snprintf(chord + len, sizeof(chord) - len, "%s+",
+					wsk_stats_mod_names[i]);
+		}
+	}
+	char base[64];
+	const char *name = base;
+	if (xkb_keysym_to_utf8(xkb_keysym_to_upper(keysym), base, sizeof(base)) <= 0
+			|| !labels_printable(base)) {
+		name = symtab_lookup(symbols, keysym);
+		if (!name) {
+			xkb_keysym_get_name(keysym, base, sizeof(base));
+			name = base;
+		}
+	}
+	snprintf(chord + len, sizeof(chord) - len, "%s", name);
+	*special = true;
+	return labels_intern(labels, chord);
+}
+
+static bool fold_key(struct wsk_keypress *tail, const struct wsk_keypress *key) {
+	if (tail->label != key->label || tail->flags != key->flags
+			|| tail->count > UINT16_MAX - key->count) {
+		return false;
+	}
+	tail->count += key->count;
+	tail->time = key->time;
+	return true;
+}
+
+static void queue_key(struct wsk_seat *seat, const struct wsk_keypress *key) {
+	if (seat->queue_len && fold_key(&seat->queue[seat->queue_len - 1], key)) {
+		++seat->folded;
+		return;
+	}
+	// Past the bound, only count; the drain turns that into one entry
+	if (seat->queue_len == WSK_KEY_QUEUE_SIZE) {
+		++seat->queue_dropped;
+		++seat->dropped;
+		return;
+	}
+	seat->queue[seat->queue_len++] = *key;
+}
+
+static void add_key(struct wsk_seat *seat, const struct wsk_keypress *key) {
+	// Repeats fold into the newest entry of the last line
+	const size_t first = seat->line_first[seat->nlines - 1];
+	struct wsk_keypress *tail =
+		seat->nkeys > first ? &seat->keys[seat->nkeys - 1] : NULL;
+	++seat->generation;
+	if (tail && fold_key(tail, key)) {
+		++seat->folded;
+		WSK_TRACE4(key_fold, trace_now(), tail->label, tail->count,
+				seat->nkeys);
+		publish_key(seat, tail, true);
+	} else {
+		if (seat->nkeys == seat->keys_size) {
+			seat->keys_size = seat->keys_size ? seat->keys_size * 2 : 32;
+			seat->keys = realloc(seat->keys,
+					seat->keys_size * sizeof(struct wsk_keypress));
+			assert(seat->keys);
+		}
+		seat->keys[seat->nkeys++] = *key;
+		WSK_TRACE4(key_append, trace_now(), key->label, key->count,
+				seat->nkeys);
+		publish_key(seat, key, false);
+	}
+	wrap_keys(seat);
+}
+
+static void publish_key(struct wsk_seat *seat,
+		const struct wsk_keypress *key, bool folded) {
+	struct wsk_feed *feed = &seat->state->feed;
+	if (!feed->header) {
+		return;
+	}
+	struct wsk_feed_key event = {
+		.time = key->time,
+		.seat = seat->global,
+		.keysym = key->keysym,
+		.count = key->count,
+		.mods = key->mods,
+		.flags = (folded ? WSK_FEED_FOLDED : 0)
+			| (key->flags & WSK_KEY_SPECIAL ? WSK_FEED_SPECIAL : 0),
+	};
+	// Truncate long chords on a character boundary
+	const char *text = labels_get(&seat->labels, key->label);
+	size_t len = strlen(text);
+	if (len >= sizeof(event.label)) {
+		len = sizeof(event.label) - 1;
+		while (len && (text[len] & 0xC0) == 0x80) {
+			--len;
+		}
+	}
+	memcpy(event.label, text, len);
+	event.label[len] = '\0';
+	feed_publish(feed, &event);
+}
+
+static void flush_key_events(struct wsk_seat *seat) {
+	if (!seat->queue_len && !seat->queue_dropped) {
+		return;
+	}
+	for (size_t i = 0; i < seat->queue_len; ++i) {
+		add_key(seat, &seat->queue[i]);
+	}
+	if (seat->queue_dropped) {
+		const uint16_t label = labels_intern(&seat->labels, "…");
+		if (label != WSK_LABEL_NONE) {
+			add_key(seat, &(struct wsk_keypress){
+				.time = seat->queue[seat->queue_len - 1].time,
+				.label = label,
+				.count = seat->queue_dropped < UINT16_MAX ?
+					seat->queue_dropped : UINT16_MAX,
+				.flags = WSK_KEY_SPECIAL,
+			});
+		}
+	}
+	seat->queue_len = 0;
+	seat->queue_dropped = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &seat->last_key);
+	set_dirty(seat);
+}
+
+static void send_key_stats(struct wsk_state *state,
+		struct wsk_ipc_client *client, bool binary) {
+	if (binary) {
+		struct wsk_stats_snapshot snapshot;
+		for (struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+			stats_snapshot(&seat->stats, seat->name, &snapshot);
+			ipc_reply(client, &snapshot, sizeof(snapshot));
+		}
+		return;
+	}
+
+	ipc_printf(client, "{\"seats\":[");
+	for (struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+		const struct wsk_key_stats *stats = &seat->stats;
+		ipc_printf(client, "%s{\"name\":", seat == state->seats ? "" : ",");
+		ipc_reply_json(client, seat->name ? seat->name : "");
+		ipc_printf(client, ",\"total\":%llu,\"kpm\":%u,"
+				"\"folded\":%llu,\"dropped\":%llu,\"combos\":{",
+				(unsigned long long)stats->total, stats_kpm(stats),
+				(unsigned long long)seat->folded,
+				(unsigned long long)seat->dropped);
+		bool first = true;
+		for (unsigned int combo = 1; combo < WSK_STATS_COMBOS; ++combo) {
+			if (!stats->combos[combo]) {
+				continue;
+			}
+			ipc_printf(client, "%s\"", first ? "" : ",");
+			for (int i = 0, n = 0; i < WSK_STATS_MODS; ++i) {
+				if (combo & (1 << i)) {
+					ipc_printf(client, "%s%s", n++ ? "+" : "",
+							wsk_stats_mod_names[i]);
+				}
+			}
+			ipc_printf(client, "\":%u", stats->combos[combo]);
+			first = false;
+		}
+		ipc_printf(client, "},\"keys\":{");
+		first = true;
+		for (uint32_t code = 0; code < WSK_STATS_KEYCODES; ++code) {
+			if (stats->presses[code]) {
+				ipc_printf(client, "%s\"%u\":%u", first ? "" : ",",
+						code, stats->presses[code]);
+				first = false;
+			}
+		}
+		ipc_printf(client, "}}");
+	}
+	ipc_printf(client, "]}\n");
+}
+
+static uint32_t parse_anchor(const char *edge) {
+	if (strcmp(edge, "top") == 0) {
+		return ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP;
+	} else if (strcmp(edge, "left") == 0) {
+		return ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT;
+	} else if (strcmp(edge, "right") == 0) {
+		return ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT;
+	} else if (strcmp(edge, "bottom") == 0) {
+		return ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM;
+	}
+	return 0;
+}
+
+static bool set_font(struct wsk_state *state, const char *spec) {
+	struct wsk_font font = { 0 };
+	if (open_font(state, &font, spec) != 0) {
+		return false;
+	}
+	font_finish(&state->pango_font);
+	state->pango_font = font;
+	free(state->font_setting);
+	state->font = state->font_setting = strdup(spec);
+	state->line_height = measure_line_height(state);
+	set_layer_placement(state);
+
+	// Layouts, tiles and line breaks are tied to the font; labels are not
+	++state->style;
+	for (struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+		for (struct wsk_raster *raster = seat->rasters;
+				raster; raster = raster->next) {
+			if (raster->layout) {
+				g_object_unref(raster->layout);
+				raster->layout = NULL;
+			}
+			glyph_cache_finish(&raster->glyphs);
+		}
+		rewrap_keys(seat);
+		set_dirty(seat);
+	}
+	return true;
+}
+
+/*
+ * Every seat gets the same anchor and margins, so each one after the first is
+ * moved a slot of max_lines lines further from the anchored edge. A surface
+ * anchored to neither or both of top and bottom is centered between the two
+ * margins, so there the top margin grows by twice the offset.
+ */
+static void place_surface(struct wsk_surface *surface) {
+	const struct wsk_state *state = surface->seat->state;
+	int slot = 0;
+	for (const struct wsk_seat *seat = state->seats;
+			seat && seat != surface->seat; seat = seat->next) {
+		++slot;
+	}
+	const int offset = slot * state->max_lines * state->line_height;
+	const uint32_t vertical = ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP
+		| ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM;
+	uint32_t anchor = state->anchor;
+	int top = state->margin, bottom = state->margin;
+	if ((anchor & vertical) == ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP) {
+		top += offset;
+	} else if ((anchor & vertical) == ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM) {
+		bottom += offset;
+	} else if (offset) {
+		anchor |= vertical;
+		top += 2 * offset;
+	}
+	zwlr_layer_surface_v1_set_anchor(surface->layer_surface, anchor);
+	zwlr_layer_surface_v1_set_margin(surface->layer_surface,
+			top, state->margin, bottom, state->margin);
+}
+
+static void set_layer_placement(struct wsk_state *state) {
+	// The compositor answers with a configure, which redraws
+	for (struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+		for (struct wsk_surface *surface = seat->surfaces;
+				surface; surface = surface->next) {
+			place_surface(surface);
+			wl_surface_commit(surface->surface);
+		}
+	}
+}
+
+static const char *apply_setting(struct wsk_state *state,
+		const char *name, char *value) {
+	bool rewrap = false;
+	if (strcmp(name, "foreground") == 0) {
+		state->foreground = parse_color(value);
+	} else if (strcmp(name, "background") == 0) {
+		state->background = parse_color(value);
+		for (struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+			for (struct wsk_surface *surface = seat->surfaces;
+					surface; surface = surface->next) {
+				set_opaque_region(surface);
+			}
+		}
+		// Opacity picks the auto quality, whose hinting changes widths
+		rewrap = true;
+	} else if (strcmp(name, "special") == 0) {
+		state->specialfg = parse_color(value);
+	} else if (strcmp(name, "font") == 0) {
+		if (!set_font(state, value)) {
+			return "unable to load font";
+		}
+		return NULL;
+	} else if (strcmp(name, "quality") == 0) {
+		if (!quality_parse(value, &state->quality)) {
+			return "unknown quality";
+		}
+		// Hinting changes label widths
+		++state->style;
+		for (struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+			rewrap_keys(seat);
+			set_dirty(seat);
+		}
+		return NULL;
+	} else if (strcmp(name, "timeout") == 0) {
+		state->timeout = atoi(value);
+		return NULL;
+	} else if (strcmp(name, "anchor") == 0) {
+		uint32_t anchor = 0;
+		for (char *edge = strtok(value, " ,"); edge; edge = strtok(NULL, " ,")) {
+			if (strcmp(edge, "none") != 0 && !parse_anchor(edge)) {
+				return "unknown edge";
+			}
+			anchor |= parse_anchor(edge);
+		}
+		state->anchor = anchor;
+		set_layer_placement(state);
+		return NULL;
+	} else if (strcmp(name, "margin") == 0) {
+		state->margin = atoi(value);
+		set_layer_placement(state);
+		// Lines are as wide as the output minus the margins
+		for (struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+			rewrap_keys(seat);
+			set_dirty(seat);
 		}
+		return NULL;
+	} else {
+		return "unknown setting";
+	}
+
+	// Colors are baked into the label tiles
+	++state->style;
+	for (struct wsk_seat *seat = state->seats; seat; seat = seat->next) {
+		if (rewrap) {
+			rewrap_keys(seat);
+		}
+		set_dirty(seat);
+	}
+	return NULL;
+}
 
-    	// 현재 키가 마지막 키와 같은지 확인
-    	struct wsk_keypress *last_key = NULL;
-    	if (state->keys) {
-    	    struct wsk_keypress *current = state->keys;
-    	    while (current->next) {
-    	        current = current->next;
-    	    }
-    	    last_key = current;
-    	}
-
-    	// UTF-8 문자 확인
-    	unsigned char current_utf8[128] = {0};
-    	bool is_special = false;
-    	if (xkb_state_key_get_utf8(state->xkb_state, keycode,
-    	        (char*)current_utf8, sizeof(current_utf8)) <= 0 ||
-    	        current_utf8[0] <= ' ' ||
-			    (current_utf8[0] >= 0x7F && current_utf8[0] <= 0x9F)
-			) {
-    	    current_utf8[0] = '\0';
-    	    is_special = true;
-    	}
-
-    	// 🔥 특수 키만 카운트, 일반 키는 항상 새로 추가
-    	bool should_count = false;
-    	if (is_special && last_key && last_key->sym == keysym && last_key->utf8[0] == '\0') {
-    	    should_count = true;  // 연속된 같은 특수 키만 카운트
-    	}
-
-    	if (should_count) {
-    	    // 🔥 특수 키 카운트 증가
-    	    last_key->count++;
-    	} else {
-    	    // 🔥 새로운 키 추가 (일반 키는 항상 여기로)
-    	    keypress = calloc(1, sizeof(struct wsk_keypress));
-    	    assert(keypress);
-    	    keypress->sym = keysym;
-    	    keypress->count = 1;
-
-    	    xkb_keysym_get_name(keypress->sym, keypress->name,
-    	            sizeof(keypress->name));
-    	    strcpy(keypress->utf8, (char*)current_utf8);
-
-    	    // 링크드 리스트 끝에 추가
-    	    struct wsk_keypress **link = &state->keys;
-    	    while (*link) {
-    	        link = &(*link)->next;
-    	    }
-    	    *link = keypress;
-    	}
-
-		trim_keys_by_width(state);
-    	break;
-	}
-
-	clock_gettime(CLOCK_MONOTONIC, &state->last_key);
-	set_dirty(state);
+static void handle_ipc_command(void *data,
+		struct wsk_ipc_client *client, char *line) {
+	struct wsk_state *state = data;
+	if (strcmp(line, "stats") == 0 || strcmp(line, "stats json") == 0) {
+		send_key_stats(state, client, false);
+	} else if (strcmp(line, "stats binary") == 0) {
+		send_key_stats(state, client, true);
+	} else if (strcmp(line, "memory") == 0) {
+		send_memory(state, client);
+	} else if (strcmp(line, "feed") == 0) {
+		if (!ipc_client_is_user(client)) {
+			ipc_printf(client, "error: permission denied\n");
+			return;
+		}
+		if (!state->feed.header && feed_init(&state->feed) != 0) {
+			ipc_printf(client, "error: unable to create the feed\n");
+			return;
+		}
+		ipc_reply_fd(client, "ok\n", state->feed.ro_fd);
+	} else if (strncmp(line, "set ", 4) == 0) {
+		char *name = line + 4;
+		char *value = strchr(name, ' ');
+		if (!value) {
+			ipc_printf(client, "error: missing value\n");
+			return;
+		}
+		*value++ = '\0';
+		const char *error = apply_setting(state, name, value);
+		if (error) {
+			ipc_printf(client, "error: %s\n", error);
+		} else {
+			ipc_printf(client, "ok\n");
+		}
+	} else {
+		ipc_printf(client, "error: unknown command\n");
+	}
 }
 
 static int libinput_open_restricted(const char *path,
@@ -590,35 +1924,35 @@ static uint32_t parse_color(const char *color) {
 }
 
 int main(int argc, char *argv[]) {
-	// Fontconfig initializations
-	if(!FcInit()) {
-		fprintf(stderr, "Failed to initialize fontconfig\n");
-		return 1;
-	}
-
-	/* NOTICE: This code runs as root */
+	/* NOTICE: This code runs as root, up to the end of option parsing */
 	struct wsk_state state = { 0 };
-	if (devmgr_start(&state.devmgr, &state.devmgr_pid, INPUTDEVPATH) > 0) {
-		return 1;
-	}
-
-	fprintf(stdout, "Compositor: %s\n", getenv("WAYLAND_DISPLAY") ?: "wayland-0");
-	fprintf(stdout, "Using compositor interfaces...\n");
-
-
-	/* Begin normal user code: */
+	startup_init(&state.startup);
 	int ret = 0;
+	pthread_t font_thread, input_thread;
+	bool font_running = false, input_running = false;
+	int err;
 
-	unsigned int anchor = 0;
-	int margin = 32;
+	state.margin = 32;
+	state.max_lines = 1;
 	state.background = 0x000000CC;
 	state.specialfg = 0xAAAAAAFF;
 	state.foreground = 0xFFFFFFFF;
 	state.font = "monospace 24";
 	state.timeout = 1;
-
+	state.fallback_fonts = WSK_FALLBACK_FONTS;
+
+	static const struct option long_options[] = {
+		{ "startup-profile", no_argument, NULL, 'P' },
+		{ "socket", required_argument, NULL, 'S' },
+		{ "low-latency", no_argument, NULL, 'L' },
+		{ "memory-budget", no_argument, NULL, 'M' },
+		{ "fallback-fonts", required_argument, NULL, 'B' },
+		{ "replay", required_argument, NULL, 'R' },
+		{ 0 },
+	};
 	int c;
-	while ((c = getopt(argc, argv, "hb:f:s:F:t:a:m:o:")) != -1) {
+	while ((c = getopt_long(argc, argv, "hb:f:s:F:q:t:a:m:o:l:",
+					long_options, NULL)) != -1) {
 		switch (c) {
 		case 'b':
 			state.background = parse_color(optarg);
@@ -632,49 +1966,134 @@ int main(int argc, char *argv[]) {
 		case 'F':
 			state.font = optarg;
 			break;
+		case 'q':
+			if (!quality_parse(optarg, &state.quality)) {
+				fprintf(stderr, "Quality must be auto, fast, balanced "
+						"or best\n");
+				return 1;
+			}
+			break;
 		case 't':
 			state.timeout = atoi(optarg);
 			break;
 		case 'a':
-			if (strcmp(optarg, "top") == 0) {
-				anchor |= ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP;
-			} else if (strcmp(optarg, "left") == 0) {
-				anchor |= ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT;
-			} else if (strcmp(optarg, "right") == 0) {
-				anchor |= ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT;
-			} else if (strcmp(optarg, "bottom") == 0) {
-				anchor |= ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM;
-			}
+			state.anchor |= parse_anchor(optarg);
 			break;
 		case 'm':
-			margin = atoi(optarg);
+			state.margin = atoi(optarg);
+			break;
+		case 'l':
+			state.max_lines = atoi(optarg);
+			if (state.max_lines < 1 || state.max_lines > WSK_MAX_LINES) {
+				fprintf(stderr, "Lines must be between 1 and %d\n",
+						WSK_MAX_LINES);
+				return 1;
+			}
 			break;
 		case 'o':
-			fprintf(stderr, "-o is unimplemented\n");
-			return 0;
+			state.output_names = realloc(state.output_names,
+					(state.n_output_names + 1) * sizeof(char *));
+			assert(state.output_names);
+			state.output_names[state.n_output_names++] = optarg;
+			break;
+		case 'P':
+			state.startup.enabled = true;
+			break;
+		case 'S':
+			state.ipc_path = optarg;
+			break;
+		case 'L':
+			state.low_latency = true;
+			break;
+		case 'M':
+			state.memory_budget = true;
+			break;
+		case 'B':
+			state.fallback_fonts = optarg;
+			break;
+		case 'R':
+			// Read once root is gone
+			state.replay_path = optarg;
+			break;
 		default:
 			fprintf(stderr, "usage: wshowkeys [-b|-f|-s #RRGGBB[AA]] [-F font] "
-					"[-t timeout]\n\t[-a top|left|right|bottom] [-m margin] "
-					"[-o output]\n");
+					"[-q quality]\n\t[-t timeout] [-a top|left|right|bottom] [-m margin] "
+					"[-l lines] [-o output]\n\t[--startup-profile] "
+					"[--socket path] [--low-latency]\n\t[--memory-budget] "
+					"[--fallback-fonts list] [--replay file]\n");
+			return 1;
+		}
+	}
+
+	// Parsing touches no files, so this is the first thing done as root
+	startup_begin(&state.startup, WSK_STARTUP_DEVMGR);
+	if (state.replay_path) {
+		// No devices to open, so no reason to stay root for a moment
+		state.devmgr = -1;
+		if (setgid(getgid()) != 0 || setuid(getuid()) != 0) {
+			fprintf(stderr, "Unable to drop privileges: %s\n",
+					strerror(errno));
 			return 1;
 		}
+	} else if (devmgr_start(&state.devmgr, &state.devmgr_pid, INPUTDEVPATH,
+				state.low_latency) > 0) {
+		return 1;
+	}
+	shm_keep_resident(state.low_latency);
+	startup_end(&state.startup, WSK_STARTUP_DEVMGR);
+
+	/* Begin normal user code: */
+	if (state.replay_path && replay_load(&state.replay, state.replay_path) != 0) {
+		return 1;
+	}
+	fprintf(stdout, "Compositor: %s\n", getenv("WAYLAND_DISPLAY") ?: "wayland-0");
+	fprintf(stdout, "Using compositor interfaces...\n");
+
+	// SIGUSR1 asks for a statistics dump; block it before any thread starts
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	state.signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (state.signal_fd == -1) {
+		fprintf(stderr, "signalfd: %s\n", strerror(errno));
 	}
 
+	// Font loading and device enumeration are bulk work that must not run
+	// ahead of the compositor in low-latency mode
+	pthread_attr_t startup_attr;
+	pthread_attr_init(&startup_attr);
+	pthread_attr_setinheritsched(&startup_attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&startup_attr, SCHED_OTHER);
+	pthread_attr_setschedparam(&startup_attr,
+			&(struct sched_param){ .sched_priority = 0 });
+
+	symbols_init(&state.symbols);
+	err = pthread_create(&font_thread, &startup_attr, load_fonts, &state);
+	if (err != 0) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		pthread_attr_destroy(&startup_attr);
+		ret = 1;
+		goto exit;
+	}
+	font_running = true;
+
 	state.udev = udev_new();
 	if (!state.udev) {
 		fprintf(stderr, "udev_create: %s\n", strerror(errno));
+		pthread_attr_destroy(&startup_attr);
 		ret = 1;
 		goto exit;
 	}
-
-	state.libinput = libinput_udev_create_context(
-			&libinput_impl, &state.devmgr, state.udev);
-	udev_unref(state.udev);
-	if (!state.libinput) {
-		fprintf(stderr, "libinput_udev_create_context: %s\n", strerror(errno));
+	if (!state.replay_path && (err = pthread_create(&input_thread,
+					&startup_attr, enumerate_input, &state)) != 0) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		pthread_attr_destroy(&startup_attr);
 		ret = 1;
 		goto exit;
 	}
+	input_running = !state.replay_path;
+	pthread_attr_destroy(&startup_attr);
 
 	state.xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
 	if (!state.xkb_context) {
@@ -682,19 +2101,22 @@ int main(int argc, char *argv[]) {
 		ret = 1;
 		goto exit;
 	}
-	fprintf(stdout, "XKB context created successfully\n");
 
+	startup_begin(&state.startup, WSK_STARTUP_CONNECT);
 	state.display = wl_display_connect(NULL);
 	if (!state.display) {
 		fprintf(stderr, "wl_display_connect: %s\n", strerror(errno));
 		ret = 1;
 		goto exit;
 	}
+	startup_end(&state.startup, WSK_STARTUP_CONNECT);
 
+	startup_begin(&state.startup, WSK_STARTUP_REGISTRY);
 	state.registry = wl_display_get_registry(state.display);
 	assert(state.registry);
 	wl_registry_add_listener(state.registry, &registry_listener, &state);
 	wl_display_roundtrip(state.display);
+	startup_end(&state.startup, WSK_STARTUP_REGISTRY);
 
 	const struct {
 		const char *name;
@@ -702,7 +2124,7 @@ int main(int argc, char *argv[]) {
 	} need_globals[] = {
 		"wl_compositor", &state.compositor,
 		"wl_shm", &state.shm,
-		"wl_seat", &state.seat,
+		"wl_seat", &state.seats,
 		"wlr_layer_shell", &state.layer_shell,
 	};
 	for (size_t i = 0; i < sizeof(need_globals) / sizeof(need_globals[0]); ++i) {
@@ -714,54 +2136,89 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	// TODO: Listener for xdg output
+	if (state.output_names && !state.output_mgr) {
+		fprintf(stderr, "Error: -o requires the xdg-output protocol\n");
+		ret = 1;
+		goto exit;
+	}
+	for (struct wsk_output *output = state.outputs;
+			output; output = output->next) {
+		output_init_xdg(&state, output);
+	}
+
+	// Seat names arrive next and each named seat creates its surfaces, which
+	// are placed by line height; configure events in the same read render.
+	// So the font has to be ready before that roundtrip.
+	startup_begin(&state.startup, WSK_STARTUP_FONT_WAIT);
+	pthread_join(font_thread, NULL);
+	font_running = false;
+	startup_end(&state.startup, WSK_STARTUP_FONT_WAIT);
+	if (!state.font_loaded) {
+		ret = 1;
+		goto exit;
+	}
 
-	wl_seat_add_listener(state.seat, &wl_seat_listener, &state);
+	if (input_running) {
+		pthread_join(input_thread, NULL);
+		input_running = false;
+	}
+	startup_begin(&state.startup, WSK_STARTUP_SEATS);
 	wl_display_roundtrip(state.display);
-	
-	state.surface = wl_compositor_create_surface(state.compositor);
-	assert(state.surface);
+	startup_end(&state.startup, WSK_STARTUP_SEATS);
+	if (state.spare_libinput) {
+		libinput_unref(state.spare_libinput);
+		state.spare_libinput = NULL;
+	}
 
-	state.layer_surface = zwlr_layer_shell_v1_get_layer_surface(
-			state.layer_shell, state.surface, NULL,
-			ZWLR_LAYER_SHELL_V1_LAYER_TOP, "showkeys");
-	assert(state.layer_surface);
+	bool have_input = false;
+	for (struct wsk_seat *seat = state.seats; seat; seat = seat->next) {
+		have_input = have_input || seat_reads_input(seat);
+	}
+	if (!have_input) {
+		fprintf(stderr, "Error: unable to read input for any seat\n");
+		ret = 1;
+		goto exit;
+	}
 
-	wl_surface_add_listener(state.surface, &wl_surface_listener, &state);
-	zwlr_layer_surface_v1_add_listener(
-			state.layer_surface, &layer_surface_listener, &state);
-	zwlr_layer_surface_v1_set_size(state.layer_surface, 1, 1);
-	zwlr_layer_surface_v1_set_anchor(state.layer_surface, anchor);
-	zwlr_layer_surface_v1_set_margin(state.layer_surface,
-			margin, margin, margin, margin);
-	zwlr_layer_surface_v1_set_exclusive_zone(state.layer_surface, -1);
-	wl_surface_commit(state.surface);
-
-	// Configure 이벤트 대기
-    int retry_count = 0;
-    while ((state.width == 0 || state.height == 0) && retry_count < 10) {
-		wl_display_roundtrip(state.display);
-		retry_count++;
-	}
-
-	retry_count = 0;
-    while ((state.width == 0 || state.height == 0) && retry_count < 10) {
-        wl_display_dispatch(state.display);
-        retry_count++;
-    }
-    
-    if (state.width == 0 || state.height == 0) {
-        fprintf(stderr, "Layer surface configuration failed\n");
-        ret = 1;
-        goto exit;
-    }
+	// Output scales arrived with the seats
+	warm_up_output_scales(&state);
 
-	struct pollfd pollfds[] = {
-		{ .fd = libinput_get_fd(state.libinput), .events = POLLIN, },
-		{ .fd = wl_display_get_fd(state.display), .events = POLLIN, },
-	};
+	if (state.output_names && !surfaces_configured(&state)) {
+		fprintf(stdout, "Waiting for a requested output to appear\n");
+	}
+
+	// One roundtrip answers the initial commits; only a missing output
+	// needs to be waited for
+	startup_begin(&state.startup, WSK_STARTUP_CONFIGURE);
+	wl_display_roundtrip(state.display);
+	for (int retry = 0; !surfaces_configured(&state) && retry < 10; ++retry) {
+		if (wl_display_dispatch(state.display) == -1) {
+			break;
+		}
+	}
+	startup_end(&state.startup, WSK_STARTUP_CONFIGURE);
+
+	if (!surfaces_configured(&state)) {
+		fprintf(stderr, "Layer surface configuration failed\n");
+		ret = 1;
+		goto exit;
+	}
+
+	if (state.startup.enabled) {
+		startup_report(&state.startup, stdout);
+	}
+
+	if (state.ipc_path && ipc_init(&state.ipc, state.ipc_path,
+				handle_ipc_command, &state) != 0) {
+		ret = 1;
+		goto exit;
+	}
+
+	struct pollfd *pollfds = NULL;
+	size_t pollfds_size = 0;
 
 	state.run = true;
+	replay_start(&state.replay, monotonic_us());
 	while (state.run) {
 		errno = 0;
 		do {
@@ -770,55 +2227,149 @@ int main(int argc, char *argv[]) {
 				break;
 			}
 		} while (errno == EAGAIN);
+		record_latency(&state);
 
+		// The fixed slots, one per seat in list order, then the IPC socket
+		size_t npollfds = WSK_POLL_SEATS + WSK_IPC_POLLFDS;
 		int timeout = -1;
-		if (state.keys) {
-			timeout = 100;
+		bool showing = false;
+		for (struct wsk_seat *seat = state.seats; seat; seat = seat->next) {
+			++npollfds;
+			if (seat->nkeys) {
+				timeout = 100;
+				showing = true;
+			}
+		}
+		if (state.replay_path) {
+			// Done once the last keys have been shown and cleared again
+			if (replay_done(&state.replay) && !showing) {
+				break;
+			}
+			const int due = replay_timeout(&state.replay, monotonic_us());
+			if (due >= 0 && (timeout < 0 || due < timeout)) {
+				timeout = due;
+			}
+		}
+		if (npollfds > pollfds_size) {
+			pollfds = realloc(pollfds, npollfds * sizeof(struct pollfd));
+			assert(pollfds);
+			pollfds_size = npollfds;
 		}
+		pollfds[WSK_POLL_DISPLAY] = (struct pollfd){
+			.fd = wl_display_get_fd(state.display),
+			.events = POLLIN,
+		};
+		pollfds[WSK_POLL_SIGNAL] = (struct pollfd){
+			.fd = state.signal_fd,
+			.events = POLLIN,
+		};
+		size_t i = WSK_POLL_SEATS;
+		for (struct wsk_seat *seat = state.seats; seat; seat = seat->next) {
+			pollfds[i++] = (struct pollfd){
+				.fd = seat->libinput ? libinput_get_fd(seat->libinput) : -1,
+				.events = POLLIN,
+			};
+		}
+		const size_t ipc_slot = i;
+		npollfds = ipc_slot + ipc_fill_pollfds(&state.ipc, pollfds + ipc_slot);
 
-		if (poll(pollfds, sizeof(pollfds) / sizeof(pollfds[0]), timeout) < 0) {
+		if (poll(pollfds, npollfds, timeout) < 0) {
 			fprintf(stderr, "poll: %s\n", strerror(errno));
 			break;
 		}
 
-		/* Clear out old keys */
+		if (pollfds[WSK_POLL_SIGNAL].revents & POLLIN) {
+			struct signalfd_siginfo info;
+			while (read(state.signal_fd, &info, sizeof(info)) == sizeof(info)) {
+				dump_stats(&state);
+			}
+		}
+
 		struct timespec now;
 		clock_gettime(CLOCK_MONOTONIC, &now);
-		if (now.tv_sec >= state.last_key.tv_sec + state.timeout &&
-				now.tv_nsec >= state.last_key.tv_nsec) {
-			struct wsk_keypress *key = state.keys;
-			while (key) {
-				struct wsk_keypress *next = key->next;
-				free(key);
-				key = next;
+		i = WSK_POLL_SEATS;
+		for (struct wsk_seat *seat = state.seats; seat; seat = seat->next) {
+			/* Clear out old keys */
+			if (seat->nkeys &&
+					now.tv_sec >= seat->last_key.tv_sec + state.timeout &&
+					now.tv_nsec >= seat->last_key.tv_nsec) {
+				clear_keys(seat);
+				set_dirty(seat);
 			}
-			state.keys = NULL;
-			set_dirty(&state);
-		}
 
-		if ((pollfds[0].revents & POLLIN)) {
-			if (libinput_dispatch(state.libinput) != 0) {
+			if (!(pollfds[i++].revents & POLLIN)) {
+				continue;
+			}
+			if (libinput_dispatch(seat->libinput) != 0) {
 				fprintf(stderr, "libinput_dispatch: %s\n", strerror(errno));
+				state.run = false;
 				break;
 			}
+			// libinput allocates its events while dispatching; handling
+			// them and drawing the result should not allocate at all
+			const uint64_t warmups = seat_warmups(seat);
+			alloc_track_begin();
 			struct libinput_event *event;
-			while ((event = libinput_get_event(state.libinput))) {
-				handle_libinput_event(&state, event);
+			while ((event = libinput_get_event(seat->libinput))) {
+				handle_libinput_event(seat, event);
 				libinput_event_destroy(event);
 			}
+			// One render for the whole batch
+			flush_key_events(seat);
+			check_allocs(seat, alloc_track_end(), warmups);
 		}
 
-		if ((pollfds[1].revents & POLLIN)
+		if (state.replay_seat) {
+			replay_keys(state.replay_seat, &state.replay);
+		}
+
+		// Served after input so a snapshot never delays a key
+		ipc_dispatch(&state.ipc, pollfds + ipc_slot);
+
+		if (state.run && (pollfds[WSK_POLL_DISPLAY].revents & POLLIN)
 				&& wl_display_dispatch(state.display) == -1) {
 			fprintf(stderr, "wl_display_dispatch: %s\n", strerror(errno));
 			break;
 		}
 	}
+	free(pollfds);
 
 exit:
+	if (input_running) {
+		pthread_join(input_thread, NULL);
+	}
+	if (font_running) {
+		pthread_join(font_thread, NULL);
+	}
+	if (state.spare_libinput) {
+		libinput_unref(state.spare_libinput);
+	}
 	FcInit();
+	while (state.seats) {
+		destroy_seat(state.seats);
+	}
+	while (state.outputs) {
+		destroy_output(state.outputs);
+	}
+	free(state.output_names);
+	ipc_finish(&state.ipc);
+	feed_finish(&state.feed);
+	free(state.font_setting);
+	g_free(state.label_corpus);
+	font_finish(&state.pango_font);
+	keymap_cache_finish(&state.keymap_cache);
+	compose_table_finish(&state.compose_table);
+	symbols_finish(&state.symbols);
 	wl_display_disconnect(state.display);
-	libinput_unref(state.libinput);
-	devmgr_finish(state.devmgr, state.devmgr_pid);
+	if (state.udev) {
+		udev_unref(state.udev);
+	}
+	if (state.signal_fd > 0) {
+		close(state.signal_fd);
+	}
+	replay_finish(&state.replay);
+	if (state.devmgr != -1) {
+		devmgr_finish(state.devmgr, state.devmgr_pid);
+	}
 	return ret;
 }
@@ -5,12 +5,20 @@
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -27,9 +35,23 @@
 #include "xdg-output-unstable-v1-client-protocol.h"
 
 /* Project headers */
+#include "alloc.h"
+#include "compose.h"
 #include "devmgr.h"
+#include "feed.h"
+#include "glyphs.h"
+#include "image.h"
+#include "keymap.h"
+#include "labels.h"
+#include "latency.h"
 #include "pango.h"
+#include "ipc.h"
 #include "shm.h"
+#include "stats.h"
+#include "startup.h"
+#include "replay.h"
+#include "symbols.h"
+#include "trace.h"
 
 /* Constants */
 #ifndef INPUTDEVPATH
@@ -39,69 +61,302 @@
 /* Forward declarations */
 struct wsk_keypress;
 struct wsk_output;
+struct wsk_raster;
+struct wsk_seat;
 struct wsk_state;
+struct wsk_surface;
+
+#define WSK_MAX_LINES 16
+#define WSK_KEY_QUEUE_SIZE 64
+
+/* Per raster cache limits and the only fallback fonts with --memory-budget */
+#define WSK_BUDGET_GLYPH_BYTES (256 * 1024)
+#define WSK_BUDGET_TILE_BYTES (1024 * 1024)
+#define WSK_FALLBACK_FONTS "DejaVu Sans,Noto Sans Symbols,Noto Sans Symbols2"
+
+/* Repeat counts are drawn from the digit labels and these two */
+#define WSK_COUNT_TIMES 10
+#define WSK_COUNT_SPACE 11
+#define WSK_COUNT_LABELS 12
+/* A label, " x", up to five digits and a trailing space */
+#define WSK_KEY_TILES 8
+
+/* Fixed slots of the main loop's poll set; one slot per seat follows */
+enum wsk_poll_slot {
+    WSK_POLL_DISPLAY,
+    WSK_POLL_SIGNAL,
+    WSK_POLL_SEATS,
+};
 
 /* Structure definitions */
+#define WSK_KEY_SPECIAL (1 << 0)
+
+/* One history entry; the label text lives in the seat's label table */
 struct wsk_keypress {
-    xkb_keysym_t sym;
-    char name[128];
-    char utf8[128];
-    int count;
-    struct wsk_keypress *next;
+    uint32_t time;
+    uint32_t keysym;
+    uint16_t label;
+    uint16_t count;
+    uint8_t mods;
+    uint8_t flags;
 };
 
 struct wsk_output {
+    struct wsk_state *state;
     struct wl_output *output;
+    struct zxdg_output_v1 *xdg_output;
+    uint32_t global;
+    char *name;
     int scale, width, heigh;
+    int logical_width, logical_height;
     enum wl_output_subpixel subpixel;
     struct wsk_output *next;
 };
 
+/* A layer surface showing one seat's keys, optionally pinned to an output */
+struct wsk_surface {
+    struct wsk_seat *seat;
+    struct wsk_output *output;
+    bool pinned;
+    struct wl_surface *surface;
+    struct zwlr_layer_surface_v1 *layer_surface;
+    uint32_t width, height;
+    bool configured;
+    struct pool_buffer buffers[2];
+    struct pool_buffer *current_buffer;
+    // What the last commit showed; cleared when the surface needs redrawing
+    bool shown;
+    uint64_t shown_generation, shown_style;
+    uint64_t frames, skipped, bytes_uploaded;
+    struct wsk_surface *next;
+};
+
+/*
+ * The key lines composed once per frame for all surfaces sharing a scale.
+ * Each label is drawn into a tile the first time it shows up; frames after
+ * that only copy tiles.
+ */
+struct wsk_raster {
+    int scale;
+    enum wl_output_subpixel subpixel;
+    enum wsk_quality quality;
+    PangoLayout *layout;
+    struct wsk_glyph_cache glyphs;
+    int line_height, baseline;
+    // Tiles by label id, [1] in the special key color
+    struct wsk_image *tiles[2];
+    size_t ntiles;
+    // Pixel bytes held by tiles, and where eviction resumes
+    size_t tile_bytes, evict_next;
+    uint64_t tiles_evicted;
+    uint32_t labels_generation;
+    uint64_t style;
+    struct wsk_image image;
+    // The keys the image shows, so the next frame only draws what changed
+    struct wsk_keypress *shown;
+    size_t nshown, shown_size;
+    size_t shown_first[WSK_MAX_LINES];
+    size_t nshown_lines;
+    uint64_t shown_evicted;
+    bool drawn;
+    uint64_t frame, full_redraws, scrolls;
+    struct wsk_raster *next;
+};
+
+/* Everything that belongs to one wl_seat: input, keymap, history, overlay */
+struct wsk_seat {
+    struct wsk_state *state;
+    struct wl_seat *wl_seat;
+    uint32_t global;
+    char *name;
+    struct wl_keyboard *keyboard;
+    struct libinput *libinput;
+
+    struct xkb_state *xkb_state;
+    struct xkb_keymap *xkb_keymap;
+
+    struct wsk_key_stats stats;
+    struct wsk_compose compose;
+    struct wsk_labels labels;
+    struct wsk_keypress *keys;
+    size_t nkeys, keys_size;
+
+    // Key events of the current input batch, folded as they arrive
+    struct wsk_keypress queue[WSK_KEY_QUEUE_SIZE];
+    size_t queue_len;
+    uint32_t queue_dropped;
+    bool chorded;
+    uint64_t folded, dropped;
+
+    uint16_t count_labels[WSK_COUNT_LABELS];
+
+    // Each line starts at keys[line_first[i]]
+    size_t line_first[WSK_MAX_LINES];
+    size_t nlines;
+    // Keys dropped from the front of the history, ever
+    uint64_t evicted;
+    // Bumped whenever keys are added, counted or cleared
+    uint64_t generation;
+    struct timespec last_key;
+
+    // Cache fills (tiles, buffers, labels) that account for allocations
+    // on the keystroke path
+    uint64_t warmups, allocs, warm_frames, steady_frames;
+
+    // Timestamp of the first key of the batch not yet sent, microseconds
+    uint64_t batch_us;
+    struct wsk_latency latency;
+
+    struct wsk_surface *surfaces;
+    struct wsk_raster *rasters;
+    struct wsk_seat *next;
+};
+
 struct wsk_state {
     int devmgr;
     pid_t devmgr_pid;
+    int signal_fd;
     struct udev *udev;
-    struct libinput *libinput;
+    struct libinput *spare_libinput;
+    struct wsk_startup startup;
 
     uint32_t foreground, background, specialfg;
+    // Bumped when colors or the font change, which invalidates label tiles
+    uint64_t style;
     const char *font;
+    char *font_setting;
+    enum wsk_quality quality;
+    struct wsk_font pango_font;
+    bool font_loaded;
+    char *label_corpus;
+    double font_warm_up_ms;
     int timeout;
+    struct wsk_symtab symbols;
 
     struct wl_display *display;
     struct wl_registry *registry;
     struct wl_compositor *compositor;
     struct wl_shm *shm;
-    struct wl_seat *seat;
-    struct wl_keyboard *keyboard;
     struct zxdg_output_manager_v1 *output_mgr;
     struct zwlr_layer_shell_v1 *layer_shell;
 
-    struct wl_surface *surface;
-    struct zwlr_layer_surface_v1 *layer_surface;
-    uint32_t width, height;
-    bool frame_scheduled, dirty;
-    struct pool_buffer buffers[2];
-    struct pool_buffer *current_buffer;
-    struct wsk_output *output, *outputs;
+    uint32_t anchor;
+    int margin;
+    int max_lines;
+    // Logical height of a line of keys at scale 1, for stacking seats
+    int line_height;
+    char **output_names;
+    size_t n_output_names;
+
+    uint64_t frame;
+    struct wsk_output *outputs;
+    struct wsk_seat *seats;
+
+    // Created on the first feed request
+    struct wsk_feed feed;
 
-    struct xkb_state *xkb_state;
     struct xkb_context *xkb_context;
-    struct xkb_keymap *xkb_keymap;
+    struct wsk_keymap_cache keymap_cache;
+    struct wsk_compose_table compose_table;
 
-    struct wsk_keypress *keys;
-    struct timespec last_key;
+    const char *ipc_path;
+    struct wsk_ipc ipc;
 
+    // Key events from a file instead of libinput, shown on one seat
+    const char *replay_path;
+    struct wsk_replay replay;
+    struct wsk_seat *replay_seat;
+
+    bool low_latency;
+    // Private fontconfig setup and capped caches
+    bool memory_budget;
+    const char *fallback_fonts;
     bool run;
 };
 
 /* Function prototypes */
-static void cairo_set_source_u32(cairo_t *cairo, uint32_t color);
-static void trim_keys_by_width(struct wsk_state *state);
+static size_t key_tiles(const struct wsk_seat *seat,
+        const struct wsk_keypress *key, uint16_t tiles[static WSK_KEY_TILES],
+        bool special[static WSK_KEY_TILES]);
+static const struct wsk_image *get_tile(struct wsk_seat *seat,
+        struct wsk_raster *raster, uint16_t label, bool special);
+static uint32_t key_width(struct wsk_seat *seat, struct wsk_raster *raster,
+        const struct wsk_keypress *key);
+static int line_width_limit(const struct wsk_seat *seat,
+        const struct wsk_output *output, int scale);
+static void drop_first_line(struct wsk_seat *seat);
+static void wrap_keys(struct wsk_seat *seat);
+static void rewrap_keys(struct wsk_seat *seat);
 static cairo_subpixel_order_t to_cairo_subpixel_order(enum wl_output_subpixel subpixel);
-static void render_to_cairo(cairo_t *cairo, struct wsk_state *state,
-        int scale, uint32_t *width, uint32_t *height);
-static void render_frame(struct wsk_state *state);
-static void set_dirty(struct wsk_state *state);
+static enum wsk_quality choose_quality(const struct wsk_state *state,
+        enum wl_output_subpixel subpixel);
+static cairo_font_options_t *output_font_options(
+        const struct wsk_state *state, enum wl_output_subpixel subpixel);
+static char *build_label_corpus(const struct wsk_state *state);
+static double warm_up_fonts(struct wsk_state *state, int scale,
+        enum wl_output_subpixel subpixel);
+static void warm_up_output_scales(struct wsk_state *state);
+static int measure_line_height(const struct wsk_state *state);
+static int open_font(const struct wsk_state *state,
+        struct wsk_font *font, const char *spec);
+static void *load_fonts(void *data);
+static void *enumerate_input(void *data);
+static struct wsk_raster *get_raster(struct wsk_seat *seat,
+        const struct wsk_output *output);
+static void validate_raster(struct wsk_seat *seat, struct wsk_raster *raster);
+static void evict_tiles(struct wsk_raster *raster,
+        const struct wsk_image *keep, size_t budget);
+static void destroy_raster(struct wsk_raster *raster);
+static bool same_key(const struct wsk_keypress *a,
+        const struct wsk_keypress *b);
+static uint32_t draw_key(struct wsk_seat *seat, struct wsk_raster *raster,
+        const struct wsk_keypress *key, uint32_t x, uint32_t y);
+static size_t reuse_keys(struct wsk_seat *seat, struct wsk_raster *raster,
+        size_t line, uint64_t drop, uint32_t *x);
+static void remember_keys(struct wsk_seat *seat, struct wsk_raster *raster);
+static void render_raster(struct wsk_seat *seat, struct wsk_raster *raster);
+static void surface_buffer_release(void *data);
+static bool render_surface(struct wsk_surface *surface,
+        const struct wsk_raster *raster);
+static void render_frame(struct wsk_seat *seat);
+static void set_dirty(struct wsk_seat *seat);
+static uint64_t seat_warmups(const struct wsk_seat *seat);
+static void check_allocs(struct wsk_seat *seat,
+        uint64_t allocs, uint64_t warmups);
+
+/* Surface, output and seat management */
+static struct wsk_surface *create_surface(struct wsk_seat *seat,
+        struct wsk_output *output);
+static void destroy_surface(struct wsk_surface *surface);
+static void set_opaque_region(struct wsk_surface *surface);
+static uint32_t choose_shm_format(const struct wsk_state *state);
+static void seat_create_surfaces(struct wsk_seat *seat);
+static void destroy_seat(struct wsk_seat *seat);
+static void clear_keys(struct wsk_seat *seat);
+static void seat_set_keymap(struct wsk_seat *seat, struct xkb_keymap *keymap,
+        const struct wsk_labels *prefill);
+static size_t resident_bytes(void);
+static void dump_stats(const struct wsk_state *state);
+static uint64_t monotonic_us(void);
+static void replay_keys(struct wsk_seat *seat, struct wsk_replay *replay);
+static void send_memory(struct wsk_state *state,
+        struct wsk_ipc_client *client);
+static void record_latency(struct wsk_state *state);
+static void send_key_stats(struct wsk_state *state,
+        struct wsk_ipc_client *client, bool binary);
+static uint32_t parse_anchor(const char *edge);
+static bool set_font(struct wsk_state *state, const char *spec);
+static void place_surface(struct wsk_surface *surface);
+static void set_layer_placement(struct wsk_state *state);
+static const char *apply_setting(struct wsk_state *state,
+        const char *name, char *value);
+static void handle_ipc_command(void *data,
+        struct wsk_ipc_client *client, char *line);
+static bool output_is_selected(const struct wsk_state *state,
+        const struct wsk_output *output);
+static void output_init_xdg(struct wsk_state *state, struct wsk_output *output);
+static void destroy_output(struct wsk_output *output);
+static bool surfaces_configured(const struct wsk_state *state);
 
 /* Wayland listener callbacks */
 static void layer_surface_configure(void *data,
@@ -131,6 +386,7 @@ static void keyboard_repeat_info(void *data, struct wl_keyboard *wl_keyboard,
 
 /* Seat event callbacks */
 static void seat_capabilities(void *data, struct wl_seat *wl_seat, uint32_t capabilities);
+static bool seat_reads_input(const struct wsk_seat *seat);
 static void seat_name(void *data, struct wl_seat *wl_seat, const char *name);
 
 /* Output event callbacks */
@@ -143,6 +399,17 @@ static void output_mode(void *data, struct wl_output *wl_output,
 static void output_done(void *data, struct wl_output *wl_output);
 static void output_scale(void *data, struct wl_output *wl_output, int32_t factor);
 
+/* xdg-output event callbacks */
+static void xdg_output_logical_position(void *data,
+        struct zxdg_output_v1 *xdg_output, int32_t x, int32_t y);
+static void xdg_output_logical_size(void *data,
+        struct zxdg_output_v1 *xdg_output, int32_t width, int32_t height);
+static void xdg_output_done(void *data, struct zxdg_output_v1 *xdg_output);
+static void xdg_output_name(void *data,
+        struct zxdg_output_v1 *xdg_output, const char *name);
+static void xdg_output_description(void *data,
+        struct zxdg_output_v1 *xdg_output, const char *description);
+
 /* Registry event callbacks */
 static void registry_global(void *data, struct wl_registry *wl_registry,
         uint32_t name, const char *interface, uint32_t version);
@@ -150,12 +417,23 @@ static void registry_global_remove(void *data,
         struct wl_registry *wl_registry, uint32_t name);
 
 /* Input event handling */
-static void handle_libinput_event(struct wsk_state *state,
+static uint16_t key_label(struct wsk_seat *seat, xkb_keycode_t keycode,
+        xkb_keysym_t keysym, unsigned int mods, bool *special);
+static bool fold_key(struct wsk_keypress *tail, const struct wsk_keypress *key);
+static void queue_key(struct wsk_seat *seat, const struct wsk_keypress *key);
+static void add_key(struct wsk_seat *seat, const struct wsk_keypress *key);
+static void publish_key(struct wsk_seat *seat,
+        const struct wsk_keypress *key, bool folded);
+static void flush_key_events(struct wsk_seat *seat);
+static void handle_key(struct wsk_seat *seat, uint32_t key,
+        enum libinput_key_state key_state, uint64_t time_us);
+static void handle_libinput_event(struct wsk_seat *seat,
         struct libinput_event *event);
 
 /* libinput interface callbacks */
 static int libinput_open_restricted(const char *path, int flags, void *data);
 static void libinput_close_restricted(int fd, void *data);
+static const struct libinput_interface libinput_impl;
 
 /* Utility functions */
 static uint32_t parse_color(const char *color);
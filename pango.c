@@ -1,77 +1,291 @@
 #include <cairo/cairo.h>
+#include <fontconfig/fontconfig.h>
 #include <pango/pangocairo.h>
+#include <pango/pangofc-fontmap.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "cairo.h"
+#include "pango.h"
 
-PangoLayout *get_pango_layout(cairo_t *cairo, const char *font,
-		const char *text, double scale) {
-	PangoLayout *layout = pango_cairo_create_layout(cairo);
-	PangoAttrList *attrs = pango_attr_list_new();
-	pango_layout_set_text(layout, text, -1);
-	pango_attr_list_insert(attrs, pango_attr_scale_new(scale));
-	PangoFontDescription *desc = pango_font_description_from_string(font);
-	pango_layout_set_font_description(layout, desc);
-	pango_layout_set_single_paragraph_mode(layout, 1);
-	pango_layout_set_attributes(layout, attrs);
-	pango_attr_list_unref(attrs);
-	pango_font_description_free(desc);
-	return layout;
+static void set_source_u32(cairo_t *cairo, uint32_t color) {
+	cairo_set_source_rgba(cairo,
+			(color >> (3*8) & 0xFF) / 255.0,
+			(color >> (2*8) & 0xFF) / 255.0,
+			(color >> (1*8) & 0xFF) / 255.0,
+			(color >> (0*8) & 0xFF) / 255.0);
 }
 
-void get_text_size(cairo_t *cairo, const char *font, int *width, int *height,
-		int *baseline, double scale, const char *fmt, ...) {
-	va_list args;
-	va_start(args, fmt);
-	// Add one since vsnprintf excludes null terminator.
-	const int length = vsnprintf(NULL, 0, fmt, args) + 1;
-	va_end(args);
+static const char *const quality_names[] = {
+	[WSK_QUALITY_AUTO] = "auto",
+	[WSK_QUALITY_FAST] = "fast",
+	[WSK_QUALITY_BALANCED] = "balanced",
+	[WSK_QUALITY_BEST] = "best",
+};
 
-	char *buf = malloc(length);
-	if (buf == NULL) {
-		return;
+const char *quality_name(enum wsk_quality quality) {
+	return quality_names[quality];
+}
+
+bool quality_parse(const char *name, enum wsk_quality *quality) {
+	for (size_t i = 0; i < sizeof(quality_names) / sizeof(quality_names[0]); ++i) {
+		if (strcmp(name, quality_names[i]) == 0) {
+			*quality = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* fast: grayscale coverage and slight hinting, the cheapest glyphs cairo
+ * draws. balanced: grayscale with full hinting, crisp on any output.
+ * best: per-channel coverage for the output's subpixel order. */
+cairo_font_options_t *create_font_options(enum wsk_quality quality,
+		cairo_subpixel_order_t subpixel_order) {
+	cairo_font_options_t *fo = cairo_font_options_create();
+	switch (quality) {
+	case WSK_QUALITY_FAST:
+		cairo_font_options_set_antialias(fo, CAIRO_ANTIALIAS_GRAY);
+		cairo_font_options_set_hint_style(fo, CAIRO_HINT_STYLE_SLIGHT);
+		break;
+	case WSK_QUALITY_BALANCED:
+		cairo_font_options_set_antialias(fo, CAIRO_ANTIALIAS_GRAY);
+		cairo_font_options_set_hint_style(fo, CAIRO_HINT_STYLE_FULL);
+		break;
+	default:
+		cairo_font_options_set_antialias(fo, CAIRO_ANTIALIAS_SUBPIXEL);
+		cairo_font_options_set_hint_style(fo, CAIRO_HINT_STYLE_FULL);
+		cairo_font_options_set_subpixel_order(fo, subpixel_order);
+		break;
+	}
+	return fo;
+}
+
+static int load_font(struct wsk_font *font, const char *spec) {
+	font->context = pango_font_map_create_context(font->font_map);
+	font->font = pango_font_map_load_font(font->font_map,
+			font->context, font->desc);
+	if (!font->font) {
+		fprintf(stderr, "Unable to load font '%s'\n", spec);
+		font_finish(font);
+		return -1;
+	}
+	return 0;
+}
+
+int font_init(struct wsk_font *font, const char *spec) {
+	font->font_map = pango_cairo_font_map_new();
+	font->desc = pango_font_description_from_string(spec);
+	return load_font(font, spec);
+}
+
+static FcPattern *description_pattern(const PangoFontDescription *desc) {
+	FcPattern *pattern = FcPatternCreate();
+	const char *families = pango_font_description_get_family(desc);
+	char *list = strdup(families ? families : "sans-serif");
+	char *save;
+	for (char *family = strtok_r(list, ",", &save);
+			family; family = strtok_r(NULL, ",", &save)) {
+		family += strspn(family, " ");
+		FcPatternAddString(pattern, FC_FAMILY, (const FcChar8 *)family);
+	}
+	free(list);
+	FcPatternAddInteger(pattern, FC_WEIGHT, FcWeightFromOpenType(
+				pango_font_description_get_weight(desc)));
+	switch (pango_font_description_get_style(desc)) {
+	case PANGO_STYLE_ITALIC:
+		FcPatternAddInteger(pattern, FC_SLANT, FC_SLANT_ITALIC);
+		break;
+	case PANGO_STYLE_OBLIQUE:
+		FcPatternAddInteger(pattern, FC_SLANT, FC_SLANT_OBLIQUE);
+		break;
+	default:
+		break;
+	}
+	return pattern;
+}
+
+/* Adds the file the system configuration picks for the pattern, unless
+ * it only found a substitute for a family that was asked for by name */
+static bool add_match(FcConfig *system, FcConfig *config,
+		FcPattern *pattern, const char *wanted, char **family) {
+	FcConfigSubstitute(system, pattern, FcMatchPattern);
+	FcDefaultSubstitute(pattern);
+	FcResult result;
+	FcPattern *match = FcFontMatch(system, pattern, &result);
+	FcChar8 *file, *name;
+	const bool found = match
+		&& FcPatternGetString(match, FC_FILE, 0, &file) == FcResultMatch
+		&& FcPatternGetString(match, FC_FAMILY, 0, &name) == FcResultMatch
+		&& (!wanted || FcStrCmpIgnoreCase(name, (const FcChar8 *)wanted) == 0)
+		&& FcConfigAppFontAddFile(config, file);
+	if (found && family) {
+		*family = strdup((const char *)name);
+	}
+	if (match) {
+		FcPatternDestroy(match);
+	}
+	FcPatternDestroy(pattern);
+	return found;
+}
+
+/*
+ * Like font_init, but the font map gets a fontconfig configuration of its own
+ * that holds only the configured font and the fallbacks, given as family
+ * names or font files separated by commas. The system configuration and its
+ * font cache are only loaded to find those files, and dropped again.
+ */
+int font_init_minimal(struct wsk_font *font, const char *spec,
+		const char *fallbacks) {
+	FcConfig *system = FcInitLoadConfigAndFonts();
+	if (!system) {
+		fprintf(stderr, "Failed to load the fontconfig configuration\n");
+		return -1;
+	}
+	FcConfig *config = FcConfigCreate();
+	font->desc = pango_font_description_from_string(spec);
+	char *family = NULL;
+	if (!add_match(system, config,
+				description_pattern(font->desc), NULL, &family)) {
+		fprintf(stderr, "Unable to find a file for font '%s'\n", spec);
+		FcConfigDestroy(config);
+		FcConfigDestroy(system);
+		font_finish(font);
+		return -1;
 	}
-	va_start(args, fmt);
-	vsnprintf(buf, length, fmt, args);
-	va_end(args);
 
-	PangoLayout *layout = get_pango_layout(cairo, font, buf, scale);
-	pango_cairo_update_layout(cairo, layout);
-	pango_layout_get_pixel_size(layout, width, height);
-	if (baseline) {
-		*baseline = pango_layout_get_baseline(layout) / PANGO_SCALE;
+	char *list = strdup(fallbacks);
+	char *save;
+	for (char *name = strtok_r(list, ",", &save);
+			name; name = strtok_r(NULL, ",", &save)) {
+		name += strspn(name, " ");
+		bool found;
+		if (name[0] == '/') {
+			found = FcConfigAppFontAddFile(config, (const FcChar8 *)name);
+		} else {
+			FcPattern *pattern = FcPatternCreate();
+			FcPatternAddString(pattern, FC_FAMILY, (const FcChar8 *)name);
+			found = add_match(system, config, pattern, name, NULL);
+		}
+		if (!found) {
+			fprintf(stderr, "Fallback font '%s' not found\n", name);
+		}
 	}
+	free(list);
+	FcConfigDestroy(system);
+
+	// Aliases such as monospace mean nothing without the system rules
+	pango_font_description_set_family(font->desc, family);
+	free(family);
+	font->font_map = pango_cairo_font_map_new();
+	pango_fc_font_map_set_config(PANGO_FC_FONT_MAP(font->font_map), config);
+	FcConfigDestroy(config);
+	return load_font(font, spec);
+}
+
+void font_finish(struct wsk_font *font) {
+	if (font->font) {
+		g_object_unref(font->font);
+	}
+	if (font->desc) {
+		pango_font_description_free(font->desc);
+	}
+	if (font->context) {
+		g_object_unref(font->context);
+	}
+	if (font->font_map) {
+		g_object_unref(font->font_map);
+	}
+	memset(font, 0, sizeof(*font));
+}
+
+static PangoFontDescription *scaled_font_description(
+		const struct wsk_font *font, int scale) {
+	PangoFontDescription *desc = pango_font_description_copy(font->desc);
+	const int size = pango_font_description_get_size(desc);
+	if (pango_font_description_get_size_is_absolute(desc)) {
+		pango_font_description_set_absolute_size(desc, size * scale);
+	} else {
+		pango_font_description_set_size(desc, size * scale);
+	}
+	return desc;
+}
+
+double font_warm_up(const struct wsk_font *font, const char *text,
+		int scale, const cairo_font_options_t *fo) {
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// Shaping loads every face the text falls back to, drawing fills the
+	// glyph caches for this size and set of font options.
+	PangoLayout *layout = create_label_layout(font, scale, fo);
+	pango_layout_set_text(layout, text, -1);
+	int width, height;
+	pango_layout_get_pixel_size(layout, &width, &height);
+	cairo_surface_t *surface = cairo_image_surface_create(
+			CAIRO_FORMAT_ARGB32, width > 0 ? width : 1, height > 0 ? height : 1);
+	cairo_t *cairo = cairo_create(surface);
+	pango_cairo_show_layout(cairo, layout);
+	cairo_destroy(cairo);
+	cairo_surface_destroy(surface);
 	g_object_unref(layout);
-	free(buf);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start.tv_sec) * 1e3
+		+ (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+PangoLayout *create_label_layout(const struct wsk_font *font, int scale,
+		const cairo_font_options_t *fo) {
+	PangoContext *context = pango_font_map_create_context(font->font_map);
+	pango_cairo_context_set_font_options(context, fo);
+
+	PangoFontDescription *desc = scaled_font_description(font, scale);
+	PangoLayout *layout = pango_layout_new(context);
+	pango_layout_set_font_description(layout, desc);
+	pango_layout_set_single_paragraph_mode(layout, 1);
+	pango_font_description_free(desc);
+	g_object_unref(context);
+	return layout;
 }
 
-void pango_printf(cairo_t *cairo, const char *font, double scale,
-		const char *fmt, ...) {
-	va_list args;
-	va_start(args, fmt);
-	// Add one since vsnprintf excludes null terminator.
-	const int length = vsnprintf(NULL, 0, fmt, args) + 1;
-	va_end(args);
+/* Line height and baseline that fit every label made of the given text */
+void label_line_metrics(PangoLayout *layout, const char *text,
+		int *height, int *baseline) {
+	int width;
+	pango_layout_set_text(layout, text, -1);
+	pango_layout_get_pixel_size(layout, &width, height);
+	*baseline = PANGO_PIXELS(pango_layout_get_baseline(layout));
+}
 
-	char *buf = malloc(length);
-	if (buf == NULL) {
+/* Draws a label once, in its final colors and on its background, into a tile
+ * one line tall with the text on the line's baseline */
+void render_label_tile(PangoLayout *layout, const char *text,
+		int height, int baseline, uint32_t fg, uint32_t bg,
+		struct wsk_image *tile) {
+	int width, text_height;
+	pango_layout_set_text(layout, text, -1);
+	pango_layout_get_pixel_size(layout, &width, &text_height);
+	image_resize(tile, width, height);
+	if (!width || !height) {
 		return;
 	}
-	va_start(args, fmt);
-	vsnprintf(buf, length, fmt, args);
-	va_end(args);
 
-	PangoLayout *layout = get_pango_layout(cairo, font, buf, scale);
-	cairo_font_options_t *fo = cairo_font_options_create();
-	cairo_get_font_options(cairo, fo);
-	pango_cairo_context_set_font_options(pango_layout_get_context(layout), fo);
-	cairo_font_options_destroy(fo);
-	pango_cairo_update_layout(cairo, layout);
+	cairo_surface_t *surface = cairo_image_surface_create_for_data(
+			(unsigned char *)tile->pixels, CAIRO_FORMAT_ARGB32,
+			tile->width, tile->height, tile->stride * sizeof(uint32_t));
+	cairo_t *cairo = cairo_create(surface);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+	set_source_u32(cairo, bg);
+	cairo_paint(cairo);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
+	set_source_u32(cairo, fg);
+	cairo_move_to(cairo, 0,
+			baseline - PANGO_PIXELS(pango_layout_get_baseline(layout)));
 	pango_cairo_show_layout(cairo, layout);
-	g_object_unref(layout);
-	free(buf);
+	cairo_destroy(cairo);
+	cairo_surface_flush(surface);
+	cairo_surface_destroy(surface);
 }
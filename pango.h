@@ -2,15 +2,48 @@
 #define _WSK_PANGO_H
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <time.h>
 #include <cairo/cairo.h>
 #include <pango/pangocairo.h>
+#include "image.h"
 
-PangoLayout *get_pango_layout(cairo_t *cairo, const char *font,
-		const char *text, double scale);
-void get_text_size(cairo_t *cairo, const char *font, int *width, int *height,
-		int *baseline, double scale, const char *fmt, ...);
-void pango_printf(cairo_t *cairo, const char *font,
-		double scale, const char *fmt, ...);
+/* How much rasterization to pay for, cheapest first. Auto is left to the
+ * caller to resolve. */
+enum wsk_quality {
+	WSK_QUALITY_AUTO,
+	WSK_QUALITY_FAST,
+	WSK_QUALITY_BALANCED,
+	WSK_QUALITY_BEST,
+};
+
+/* The configured font, resolved once at startup */
+struct wsk_font {
+	PangoFontMap *font_map;
+	PangoContext *context;
+	PangoFontDescription *desc;
+	PangoFont *font;
+};
+
+const char *quality_name(enum wsk_quality quality);
+bool quality_parse(const char *name, enum wsk_quality *quality);
+cairo_font_options_t *create_font_options(enum wsk_quality quality,
+		cairo_subpixel_order_t subpixel_order);
+
+int font_init(struct wsk_font *font, const char *spec);
+int font_init_minimal(struct wsk_font *font, const char *spec,
+		const char *fallbacks);
+void font_finish(struct wsk_font *font);
+double font_warm_up(const struct wsk_font *font, const char *text,
+		int scale, const cairo_font_options_t *fo);
+
+PangoLayout *create_label_layout(const struct wsk_font *font, int scale,
+		const cairo_font_options_t *fo);
+void label_line_metrics(PangoLayout *layout, const char *text,
+		int *height, int *baseline);
+void render_label_tile(PangoLayout *layout, const char *text,
+		int height, int baseline, uint32_t fg, uint32_t bg,
+		struct wsk_image *tile);
 
 #endif
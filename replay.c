@@ -0,0 +1,83 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+
+int replay_load(struct wsk_replay *replay, const char *path) {
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	memset(replay, 0, sizeof(*replay));
+	size_t size = 0;
+	uint64_t at_us = 0;
+	char line[256];
+	for (int lineno = 1; fgets(line, sizeof(line), f); ++lineno) {
+		const char *p = line + strspn(line, " \t");
+		if (*p == '#' || *p == '\n' || *p == '\0') {
+			continue;
+		}
+		unsigned long delay_ms, key;
+		int pressed;
+		if (sscanf(p, "%lu %lu %d", &delay_ms, &key, &pressed) != 3
+				|| (pressed != 0 && pressed != 1)) {
+			fprintf(stderr, "%s:%d: expected <delay ms> <key code> <1|0>\n",
+					path, lineno);
+			fclose(f);
+			replay_finish(replay);
+			return -1;
+		}
+		if (replay->count == size) {
+			size = size ? size * 2 : 64;
+			replay->events = realloc(replay->events,
+					size * sizeof(struct wsk_replay_event));
+			assert(replay->events);
+		}
+		at_us += delay_ms * 1000;
+		replay->events[replay->count++] = (struct wsk_replay_event){
+			.at_us = at_us,
+			.key = key,
+			.pressed = pressed,
+		};
+	}
+	fclose(f);
+	return 0;
+}
+
+/* Delays count from here, once the overlay is up */
+void replay_start(struct wsk_replay *replay, uint64_t now_us) {
+	replay->start_us = now_us;
+	replay->next = 0;
+}
+
+/* Milliseconds until the next event is due, for poll; -1 when done */
+int replay_timeout(const struct wsk_replay *replay, uint64_t now_us) {
+	if (replay_done(replay)) {
+		return -1;
+	}
+	const uint64_t due = replay->start_us + replay->events[replay->next].at_us;
+	return due > now_us ? (int)((due - now_us + 999) / 1000) : 0;
+}
+
+bool replay_next(struct wsk_replay *replay, uint64_t now_us,
+		struct wsk_replay_event *event) {
+	if (replay_done(replay) || replay->start_us
+			+ replay->events[replay->next].at_us > now_us) {
+		return false;
+	}
+	*event = replay->events[replay->next++];
+	event->at_us += replay->start_us;
+	return true;
+}
+
+bool replay_done(const struct wsk_replay *replay) {
+	return replay->next == replay->count;
+}
+
+void replay_finish(struct wsk_replay *replay) {
+	free(replay->events);
+	memset(replay, 0, sizeof(*replay));
+}
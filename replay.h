@@ -0,0 +1,33 @@
+#ifndef _WSK_REPLAY_H
+#define _WSK_REPLAY_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Key events read from a file instead of input devices, for running against
+ * a headless compositor. One event per line: the delay in milliseconds since
+ * the previous event, the evdev key code and 1 for a press or 0 for a
+ * release. Blank lines and lines starting with # are skipped.
+ */
+struct wsk_replay_event {
+	uint64_t at_us;
+	uint32_t key;
+	bool pressed;
+};
+
+struct wsk_replay {
+	struct wsk_replay_event *events;
+	size_t count, next;
+	uint64_t start_us;
+};
+
+int replay_load(struct wsk_replay *replay, const char *path);
+void replay_start(struct wsk_replay *replay, uint64_t now_us);
+int replay_timeout(const struct wsk_replay *replay, uint64_t now_us);
+bool replay_next(struct wsk_replay *replay, uint64_t now_us,
+		struct wsk_replay_event *event);
+bool replay_done(const struct wsk_replay *replay);
+void replay_finish(struct wsk_replay *replay);
+
+#endif
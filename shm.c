@@ -1,9 +1,7 @@
 /* Portions of this file taken from sway, MIT licensed */
 #include <assert.h>
-#include <cairo/cairo.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <pango/pangocairo.h>
 #include <stdbool.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -11,6 +9,7 @@
 #include <unistd.h>
 #include <wayland-client.h>
 #include "shm.h"
+#include "trace.h"
 
 static void randname(char *buf) {
 	struct timespec ts;
@@ -58,38 +57,106 @@ int allocate_shm_file(size_t size) {
 	return fd;
 }
 
+const char *shm_format_name(uint32_t format) {
+	switch (format) {
+	case WL_SHM_FORMAT_ARGB8888:
+		return "ARGB8888";
+	case WL_SHM_FORMAT_XRGB8888:
+		return "XRGB8888";
+	}
+	return "unknown";
+}
+
 static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
 	struct pool_buffer *buffer = data;
 	buffer->busy = false;
+	WSK_TRACE2(buffer_release, trace_now(), buffer->size);
+	if (buffer->release) {
+		buffer->release(buffer->release_data);
+	}
 }
 
 static const struct wl_buffer_listener buffer_listener = {
 	.release = buffer_release
 };
 
+static bool keep_resident;
+
+/* Fault in and lock every new pool up front, so drawing into it never
+ * waits for the pager */
+void shm_keep_resident(bool resident) {
+	keep_resident = resident;
+}
+
+static void prefault(unsigned char *data, size_t size) {
+	const long page = sysconf(_SC_PAGESIZE);
+	for (size_t offset = 0; offset < size; offset += page) {
+		((volatile unsigned char *)data)[offset] = 0;
+	}
+	// Already done by mlockall(MCL_FUTURE) when it was allowed
+	mlock(data, size);
+}
+
+static bool create_pool(struct wl_shm *shm,
+		struct pool_buffer *buf, size_t size) {
+	// Room to grow, so a strip getting wider does not map a new file on
+	// every key
+	size_t capacity = buf->capacity ? buf->capacity : 64 * 1024;
+	while (capacity < size) {
+		capacity *= 2;
+	}
+
+	const int fd = allocate_shm_file(capacity);
+	if (fd == -1) {
+		return false;
+	}
+	void *data = mmap(NULL, capacity,
+			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	if (keep_resident) {
+		prefault(data, capacity);
+	}
+	buf->pool = wl_shm_create_pool(shm, fd, capacity);
+	close(fd);
+	buf->data = data;
+	buf->capacity = capacity;
+	return true;
+}
+
+static void destroy_pool(struct pool_buffer *buf) {
+	if (buf->pool) {
+		wl_shm_pool_destroy(buf->pool);
+	}
+	if (buf->data) {
+		munmap(buf->data, buf->capacity);
+	}
+	buf->pool = NULL;
+	buf->data = NULL;
+}
+
 static struct pool_buffer *create_buffer(struct wl_shm *shm,
 		struct pool_buffer *buf, int32_t width, int32_t height,
 		uint32_t format) {
 	const uint32_t stride = width * 4;
 	const size_t size = stride * height;
 
-	const int fd = allocate_shm_file(size);
-	assert(fd != -1);
-	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
-	buf->buffer = wl_shm_pool_create_buffer(pool, 0,
+	if (size > buf->capacity) {
+		destroy_pool(buf);
+	}
+	if (!buf->pool && !create_pool(shm, buf, size)) {
+		return NULL;
+	}
+	buf->buffer = wl_shm_pool_create_buffer(buf->pool, 0,
 			width, height, stride, format);
-	wl_shm_pool_destroy(pool);
-	close(fd);
 
 	buf->size = size;
 	buf->width = width;
 	buf->height = height;
-	buf->data = data;
-	buf->surface = cairo_image_surface_create_for_data(data,
-			CAIRO_FORMAT_ARGB32, width, height, stride);
-	buf->cairo = cairo_create(buf->surface);
-	buf->pango = pango_cairo_create_context(buf->cairo);
+	buf->stride = stride;
+	buf->format = format;
 
 	wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
 	return buf;
@@ -99,23 +166,13 @@ void destroy_buffer(struct pool_buffer *buffer) {
 	if (buffer->buffer) {
 		wl_buffer_destroy(buffer->buffer);
 	}
-	if (buffer->cairo) {
-		cairo_destroy(buffer->cairo);
-	}
-	if (buffer->surface) {
-		cairo_surface_destroy(buffer->surface);
-	}
-	if (buffer->pango) {
-		g_object_unref(buffer->pango);
-	}
-	if (buffer->data) {
-		munmap(buffer->data, buffer->size);
-	}
+	destroy_pool(buffer);
 	memset(buffer, 0, sizeof(struct pool_buffer));
 }
 
 struct pool_buffer *get_next_buffer(struct wl_shm *shm,
-		struct pool_buffer pool[static 2], const uint32_t width, const uint32_t height) {
+		struct pool_buffer pool[static 2], const uint32_t width,
+		const uint32_t height, const uint32_t format) {
 	struct pool_buffer *buffer = NULL;
 
 	for (size_t i = 0; i < 2; ++i) {
@@ -126,19 +183,38 @@ struct pool_buffer *get_next_buffer(struct wl_shm *shm,
 	}
 
 	if (!buffer) {
+		WSK_TRACE3(buffer_busy, trace_now(), width, height);
 		return NULL;
 	}
 
-	if (buffer->width != width || buffer->height != height) {
-		destroy_buffer(buffer);
+	if (buffer->buffer && (buffer->width != width
+			|| buffer->height != height || buffer->format != format)) {
+		// The pool and its mapping stay for the new buffer
+		wl_buffer_destroy(buffer->buffer);
+		buffer->buffer = NULL;
 	}
 
 	if (!buffer->buffer) {
-		if (!create_buffer(shm, buffer, width, height,
-					WL_SHM_FORMAT_ARGB8888)) {
+		if (!create_buffer(shm, buffer, width, height, format)) {
 			return NULL;
 		}
 	}
 	buffer->busy = true;
+	WSK_TRACE4(buffer_acquire, trace_now(), width, height, buffer->size);
 	return buffer;
 }
+
+void buffer_write(struct pool_buffer *buffer, const unsigned char *src,
+		int src_stride, uint32_t width, uint32_t height) {
+	// src is a cairo ARGB32 image, which is ARGB8888 in memory
+	if (width > buffer->width) {
+		width = buffer->width;
+	}
+	if (height > buffer->height) {
+		height = buffer->height;
+	}
+	unsigned char *dst = buffer->data;
+	for (uint32_t y = 0; y < height; ++y) {
+		memcpy(dst + y * buffer->stride, src + y * src_stride, width * 4);
+	}
+}
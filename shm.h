@@ -1,7 +1,5 @@
 #ifndef SHM_H
 #define SHM_H
-#include <cairo/cairo.h>
-#include <pango/pangocairo.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -9,19 +7,28 @@
 int create_shm_file(void);
 int allocate_shm_file(size_t size);
 
+const char *shm_format_name(uint32_t format);
+
+/* A wl_buffer carved from a pool that is kept, and only replaced when a
+ * bigger buffer no longer fits */
 struct pool_buffer {
 	struct wl_buffer *buffer;
-	cairo_surface_t *surface;
-	cairo_t *cairo;
-	PangoContext *pango;
-	uint32_t width, height;
+	struct wl_shm_pool *pool;
+	uint32_t width, height, stride, format;
 	void *data;
-	size_t size;
+	size_t size, capacity;
 	bool busy;
+	// Called when the compositor hands the buffer back, if set
+	void (*release)(void *data);
+	void *release_data;
 };
 
+void shm_keep_resident(bool resident);
 struct pool_buffer *get_next_buffer(struct wl_shm *shm,
-		struct pool_buffer pool[static 2], uint32_t width, uint32_t height);
+		struct pool_buffer pool[static 2], uint32_t width, uint32_t height,
+		uint32_t format);
+void buffer_write(struct pool_buffer *buffer, const unsigned char *src,
+		int src_stride, uint32_t width, uint32_t height);
 void destroy_buffer(struct pool_buffer *buffer);
 
 #endif
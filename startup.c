@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <time.h>
+#include "startup.h"
+
+static const char *phase_names[WSK_STARTUP_PHASES] = {
+	[WSK_STARTUP_DEVMGR] = "device manager",
+	[WSK_STARTUP_FONTS] = "fonts",
+	[WSK_STARTUP_INPUT] = "input devices",
+	[WSK_STARTUP_CONNECT] = "wayland connect",
+	[WSK_STARTUP_REGISTRY] = "wayland registry",
+	[WSK_STARTUP_SEATS] = "seats and outputs",
+	[WSK_STARTUP_CONFIGURE] = "surface configure",
+	[WSK_STARTUP_FONT_WAIT] = "waiting for fonts",
+};
+
+static double since_origin_ms(const struct wsk_startup *startup) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - startup->origin.tv_sec) * 1e3
+		+ (now.tv_nsec - startup->origin.tv_nsec) / 1e6;
+}
+
+void startup_init(struct wsk_startup *startup) {
+	clock_gettime(CLOCK_MONOTONIC, &startup->origin);
+	for (int i = 0; i < WSK_STARTUP_PHASES; ++i) {
+		startup->begin_ms[i] = startup->end_ms[i] = -1;
+	}
+}
+
+void startup_begin(struct wsk_startup *startup, enum wsk_startup_phase phase) {
+	startup->begin_ms[phase] = since_origin_ms(startup);
+}
+
+void startup_end(struct wsk_startup *startup, enum wsk_startup_phase phase) {
+	startup->end_ms[phase] = since_origin_ms(startup);
+}
+
+void startup_report(const struct wsk_startup *startup, FILE *f) {
+	fprintf(f, "Startup profile (ms since launch):\n");
+	for (int i = 0; i < WSK_STARTUP_PHASES; ++i) {
+		if (startup->begin_ms[i] < 0 || startup->end_ms[i] < 0) {
+			continue;
+		}
+		fprintf(f, "  %-20s %8.1f .. %8.1f  (%.1f)\n", phase_names[i],
+				startup->begin_ms[i], startup->end_ms[i],
+				startup->end_ms[i] - startup->begin_ms[i]);
+	}
+	fprintf(f, "  %-20s %8.1f\n", "ready", since_origin_ms(startup));
+}
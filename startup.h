@@ -0,0 +1,32 @@
+#ifndef _WSK_STARTUP_H
+#define _WSK_STARTUP_H
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+enum wsk_startup_phase {
+	WSK_STARTUP_DEVMGR,
+	WSK_STARTUP_FONTS,
+	WSK_STARTUP_INPUT,
+	WSK_STARTUP_CONNECT,
+	WSK_STARTUP_REGISTRY,
+	WSK_STARTUP_SEATS,
+	WSK_STARTUP_CONFIGURE,
+	WSK_STARTUP_FONT_WAIT,
+	WSK_STARTUP_PHASES,
+};
+
+/* Each phase is only ever written by the thread that runs it. */
+struct wsk_startup {
+	bool enabled;
+	struct timespec origin;
+	double begin_ms[WSK_STARTUP_PHASES];
+	double end_ms[WSK_STARTUP_PHASES];
+};
+
+void startup_init(struct wsk_startup *startup);
+void startup_begin(struct wsk_startup *startup, enum wsk_startup_phase phase);
+void startup_end(struct wsk_startup *startup, enum wsk_startup_phase phase);
+void startup_report(const struct wsk_startup *startup, FILE *f);
+
+#endif
@@ -0,0 +1,91 @@
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <xkbcommon/xkbcommon.h>
+#include "stats.h"
+
+const char *const wsk_stats_mod_names[WSK_STATS_MODS] = {
+	"Shift", "Ctrl", "Alt", "Super",
+};
+
+static const char *const xkb_mod_names[WSK_STATS_MODS] = {
+	XKB_MOD_NAME_SHIFT,
+	XKB_MOD_NAME_CTRL,
+	XKB_MOD_NAME_ALT,
+	XKB_MOD_NAME_LOGO,
+};
+
+void stats_set_keymap(struct wsk_key_stats *stats, struct xkb_keymap *keymap) {
+	for (int i = 0; i < WSK_STATS_MODS; ++i) {
+		stats->mods[i] = xkb_keymap_mod_get_index(keymap, xkb_mod_names[i]);
+	}
+}
+
+bool keysym_is_modifier(xkb_keysym_t sym) {
+	return (sym >= XKB_KEY_Shift_L && sym <= XKB_KEY_Hyper_R)
+		|| (sym >= XKB_KEY_ISO_Lock && sym <= XKB_KEY_ISO_Last_Group_Lock);
+}
+
+unsigned int stats_active_mods(const struct wsk_key_stats *stats,
+		struct xkb_state *xkb_state) {
+	unsigned int mods = 0;
+	for (int i = 0; i < WSK_STATS_MODS; ++i) {
+		if (stats->mods[i] != XKB_MOD_INVALID &&
+				xkb_state_mod_index_is_active(xkb_state, stats->mods[i],
+					XKB_STATE_MODS_EFFECTIVE) > 0) {
+			mods |= 1 << i;
+		}
+	}
+	return mods;
+}
+
+void stats_record(struct wsk_key_stats *stats, struct xkb_state *xkb_state,
+		uint32_t code, xkb_keysym_t sym, uint32_t time) {
+	++stats->total;
+	if (code < WSK_STATS_KEYCODES) {
+		++stats->presses[code];
+	}
+
+	if (!keysym_is_modifier(sym)) {
+		++stats->combos[stats_active_mods(stats, xkb_state)];
+	}
+
+	const uint32_t second = time / 1000;
+	struct wsk_stats_bucket *bucket =
+		&stats->window[second % WSK_STATS_WINDOW];
+	if (bucket->second != second) {
+		bucket->second = second;
+		bucket->count = 0;
+	}
+	++bucket->count;
+}
+
+uint32_t stats_kpm(const struct wsk_key_stats *stats) {
+	// libinput timestamps are CLOCK_MONOTONIC milliseconds
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	const uint32_t second = (uint32_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000)
+		/ 1000;
+	uint32_t kpm = 0;
+	for (int i = 0; i < WSK_STATS_WINDOW; ++i) {
+		if (stats->window[i].count &&
+				second - stats->window[i].second < WSK_STATS_WINDOW) {
+			kpm += stats->window[i].count;
+		}
+	}
+	return kpm;
+}
+
+void stats_snapshot(const struct wsk_key_stats *stats, const char *seat,
+		struct wsk_stats_snapshot *snapshot) {
+	memset(snapshot, 0, sizeof(*snapshot));
+	snapshot->magic = WSK_STATS_MAGIC;
+	snapshot->version = WSK_STATS_VERSION;
+	if (seat) {
+		strncpy(snapshot->seat, seat, sizeof(snapshot->seat) - 1);
+	}
+	snapshot->total = stats->total;
+	snapshot->kpm = stats_kpm(stats);
+	memcpy(snapshot->combos, stats->combos, sizeof(snapshot->combos));
+	memcpy(snapshot->presses, stats->presses, sizeof(snapshot->presses));
+}
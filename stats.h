@@ -0,0 +1,56 @@
+#ifndef _WSK_STATS_H
+#define _WSK_STATS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+
+/* evdev codes go up to KEY_MAX (0x2ff) */
+#define WSK_STATS_KEYCODES 0x300
+/* Every subset of Shift, Ctrl, Alt and Super */
+#define WSK_STATS_MODS 4
+#define WSK_STATS_COMBOS (1 << WSK_STATS_MODS)
+#define WSK_STATS_SHIFT (1 << 0)
+#define WSK_STATS_CTRL (1 << 1)
+#define WSK_STATS_ALT (1 << 2)
+#define WSK_STATS_SUPER (1 << 3)
+#define WSK_STATS_WINDOW 60
+
+#define WSK_STATS_MAGIC 0x534b5357 /* "WSKS" */
+#define WSK_STATS_VERSION 1
+
+struct wsk_stats_bucket {
+	uint32_t second, count;
+};
+
+/* Counters are only touched by the input path, in constant time per key. */
+struct wsk_key_stats {
+	xkb_mod_index_t mods[WSK_STATS_MODS];
+	uint64_t total;
+	uint32_t presses[WSK_STATS_KEYCODES];
+	uint32_t combos[WSK_STATS_COMBOS];
+	struct wsk_stats_bucket window[WSK_STATS_WINDOW];
+};
+
+/* Binary snapshot of one seat, as sent over the IPC socket */
+struct wsk_stats_snapshot {
+	uint32_t magic, version;
+	char seat[32];
+	uint64_t total;
+	uint32_t kpm;
+	uint32_t combos[WSK_STATS_COMBOS];
+	uint32_t presses[WSK_STATS_KEYCODES];
+};
+
+extern const char *const wsk_stats_mod_names[WSK_STATS_MODS];
+
+void stats_set_keymap(struct wsk_key_stats *stats, struct xkb_keymap *keymap);
+bool keysym_is_modifier(xkb_keysym_t sym);
+unsigned int stats_active_mods(const struct wsk_key_stats *stats,
+		struct xkb_state *xkb_state);
+void stats_record(struct wsk_key_stats *stats, struct xkb_state *xkb_state,
+		uint32_t code, xkb_keysym_t sym, uint32_t time);
+uint32_t stats_kpm(const struct wsk_key_stats *stats);
+void stats_snapshot(const struct wsk_key_stats *stats, const char *seat,
+		struct wsk_stats_snapshot *snapshot);
+
+#endif
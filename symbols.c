@@ -0,0 +1,68 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symbols.h"
+#include "symbols-table.h"
+
+static FILE *open_user_symbols(char *path, size_t size) {
+	const char *config = getenv("XDG_CONFIG_HOME");
+	const char *home = getenv("HOME");
+	if (config && *config) {
+		snprintf(path, size, "%s/wshowkeys/symbols", config);
+	} else if (home && *home) {
+		snprintf(path, size, "%s/.config/wshowkeys/symbols", home);
+	} else {
+		return NULL;
+	}
+
+	FILE *f = fopen(path, "r");
+	if (!f && errno != ENOENT) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	}
+	return f;
+}
+
+void symbols_init(struct wsk_symtab *tab) {
+	*tab = wsk_default_symtab;
+
+	char path[PATH_MAX];
+	FILE *f = open_user_symbols(path, sizeof(path));
+	if (!f) {
+		return;
+	}
+
+	struct wsk_symbol *syms = calloc(wsk_default_symtab.count,
+			sizeof(*syms));
+	size_t len = 0;
+	for (size_t i = 0; syms && i <= wsk_default_symtab.slot_mask; ++i) {
+		const struct wsk_symbol *slot = &wsk_default_slots[i];
+		if (slot->label) {
+			syms[len++] = (struct wsk_symbol){
+				.sym = slot->sym,
+				.label = strdup(slot->label),
+			};
+		}
+	}
+
+	struct wsk_symtab user;
+	if (syms && symtab_parse(f, path, &syms, &len) == 0
+			&& symtab_build(&user, syms, len) == 0) {
+		*tab = user;
+		fprintf(stdout, "Loaded %zu key symbols from %s\n", len, path);
+	} else {
+		fprintf(stderr, "Failed to load %s, using default symbols\n", path);
+		for (size_t i = 0; i < len; ++i) {
+			free((char *)syms[i].label);
+		}
+	}
+	free(syms);
+	fclose(f);
+}
+
+void symbols_finish(struct wsk_symtab *tab) {
+	if (tab->slots != wsk_default_slots) {
+		symtab_finish(tab);
+	}
+}
@@ -0,0 +1,8 @@
+#ifndef _WSK_SYMBOLS_H
+#define _WSK_SYMBOLS_H
+#include "symtab.h"
+
+void symbols_init(struct wsk_symtab *tab);
+void symbols_finish(struct wsk_symtab *tab);
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Build-time generator for the default keysym label table. Reads a symbol
+ * file and writes a C header with a precomputed perfect hash.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symtab.h"
+
+static void write_label(FILE *out, const char *label) {
+	fputc('"', out);
+	for (const unsigned char *p = (const unsigned char *)label; *p; ++p) {
+		fprintf(out, "\\%03o", *p);
+	}
+	fputc('"', out);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "usage: gensymbols <symbols.txt> <output.h>\n");
+		return 1;
+	}
+
+	FILE *in = fopen(argv[1], "r");
+	if (!in) {
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	struct wsk_symbol *syms = NULL;
+	size_t len = 0;
+	const int ret = symtab_parse(in, argv[1], &syms, &len);
+	fclose(in);
+	struct wsk_symtab tab;
+	if (ret != 0 || symtab_build(&tab, syms, len) != 0) {
+		return 1;
+	}
+	free(syms);
+
+	FILE *out = fopen(argv[2], "w");
+	if (!out) {
+		fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+		return 1;
+	}
+	const char *base = strrchr(argv[1], '/');
+	fprintf(out, "/* Generated by gensymbols from %s, do not edit */\n",
+			base ? base + 1 : argv[1]);
+	fprintf(out, "#ifndef _WSK_SYMBOLS_TABLE_H\n#define _WSK_SYMBOLS_TABLE_H\n");
+	fprintf(out, "#include \"symtab.h\"\n\n");
+
+	fprintf(out, "static const uint32_t wsk_default_disp[] = {");
+	for (size_t i = 0; i <= tab.bucket_mask; ++i) {
+		fprintf(out, "%s%u,", i % 8 ? " " : "\n\t", tab.disp[i]);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static const struct wsk_symbol wsk_default_slots[] = {\n");
+	for (size_t i = 0; i <= tab.slot_mask; ++i) {
+		const struct wsk_symbol *slot = &tab.slots[i];
+		if (!slot->label) {
+			fprintf(out, "\t{ 0, NULL },\n");
+			continue;
+		}
+		fprintf(out, "\t{ 0x%x, ", slot->sym);
+		write_label(out, slot->label);
+		fprintf(out, " },\n");
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "static const struct wsk_symtab wsk_default_symtab = {\n"
+			"\t.bucket_mask = 0x%x,\n\t.slot_mask = 0x%x,\n"
+			"\t.disp = wsk_default_disp,\n\t.slots = wsk_default_slots,\n"
+			"\t.count = %zu,\n};\n\n#endif\n",
+			tab.bucket_mask, tab.slot_mask, tab.count);
+
+	symtab_finish(&tab);
+	if (fclose(out) != 0) {
+		fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,190 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xkbcommon/xkbcommon.h>
+#include "symtab.h"
+
+#define MAX_DISPLACEMENT (1U << 24)
+
+int symtab_parse(FILE *f, const char *path,
+		struct wsk_symbol **syms, size_t *len) {
+	char *line = NULL;
+	size_t line_size = 0;
+	int lineno = 0;
+
+	while (getline(&line, &line_size, f) != -1) {
+		++lineno;
+		char *p = line;
+		while (isspace((unsigned char)*p)) {
+			++p;
+		}
+		if (!*p || *p == '#') {
+			continue;
+		}
+
+		char *name = p;
+		while (*p && !isspace((unsigned char)*p)) {
+			++p;
+		}
+		if (*p) {
+			*p++ = '\0';
+		}
+		while (isspace((unsigned char)*p)) {
+			++p;
+		}
+		char *label = p;
+		while (*p && !isspace((unsigned char)*p)) {
+			++p;
+		}
+		*p = '\0';
+		if (!*label) {
+			fprintf(stderr, "%s:%d: missing label for '%s'\n",
+					path, lineno, name);
+			continue;
+		}
+
+		const xkb_keysym_t sym = xkb_keysym_from_name(name,
+				XKB_KEYSYM_NO_FLAGS);
+		if (sym == XKB_KEY_NoSymbol) {
+			fprintf(stderr, "%s:%d: unknown keysym '%s'\n",
+					path, lineno, name);
+			continue;
+		}
+
+		char *copy = strdup(label);
+		if (!copy) {
+			free(line);
+			return -1;
+		}
+
+		size_t i = 0;
+		while (i < *len && (*syms)[i].sym != sym) {
+			++i;
+		}
+		if (i < *len) {
+			free((char *)(*syms)[i].label);
+		} else {
+			struct wsk_symbol *grown = realloc(*syms,
+					(*len + 1) * sizeof(**syms));
+			if (!grown) {
+				free(copy);
+				free(line);
+				return -1;
+			}
+			*syms = grown;
+			++*len;
+		}
+		(*syms)[i] = (struct wsk_symbol){ .sym = sym, .label = copy };
+	}
+
+	free(line);
+	return 0;
+}
+
+int symtab_build(struct wsk_symtab *tab,
+		const struct wsk_symbol *syms, const size_t len) {
+	size_t nslots = 1, nbuckets = 1;
+	while (nslots < len * 2) {
+		nslots <<= 1;
+	}
+	while (nbuckets * 2 < len) {
+		nbuckets <<= 1;
+	}
+	const uint32_t bucket_mask = nbuckets - 1, slot_mask = nslots - 1;
+
+	uint32_t *disp = calloc(nbuckets, sizeof(*disp));
+	struct wsk_symbol *slots = calloc(nslots, sizeof(*slots));
+	size_t *order = calloc(nbuckets, sizeof(*order));
+	size_t *members = calloc(nbuckets, sizeof(*members));
+	size_t *placed = calloc(len + 1, sizeof(*placed));
+	size_t *keys = calloc(len + 1, sizeof(*keys));
+	int ret = -1;
+	if (!disp || !slots || !order || !members || !placed || !keys) {
+		goto out;
+	}
+
+	for (size_t i = 0; i < len; ++i) {
+		++members[(symtab_mix(syms[i].sym) >> 16) & bucket_mask];
+	}
+	/* Place the largest buckets first, while the table is still empty */
+	for (size_t b = 0; b < nbuckets; ++b) {
+		size_t o = b;
+		for (; o > 0 && members[order[o - 1]] < members[b]; --o) {
+			order[o] = order[o - 1];
+		}
+		order[o] = b;
+	}
+
+	for (size_t o = 0; o < nbuckets && members[order[o]]; ++o) {
+		const size_t b = order[o];
+		size_t nkeys = 0;
+		for (size_t i = 0; i < len; ++i) {
+			if (((symtab_mix(syms[i].sym) >> 16) & bucket_mask) != b) {
+				continue;
+			}
+			for (size_t j = 0; j < nkeys; ++j) {
+				if (syms[keys[j]].sym == syms[i].sym) {
+					fprintf(stderr, "Duplicate keysym 0x%x in symbol table\n",
+							syms[i].sym);
+					goto out;
+				}
+			}
+			keys[nkeys++] = i;
+		}
+
+		uint32_t d = 0;
+		for (; d < MAX_DISPLACEMENT; ++d) {
+			size_t nplaced = 0;
+			for (; nplaced < nkeys; ++nplaced) {
+				const struct wsk_symbol *sym = &syms[keys[nplaced]];
+				const size_t s = symtab_mix(sym->sym ^ d) & slot_mask;
+				if (slots[s].label) {
+					break;
+				}
+				slots[s] = *sym;
+				placed[nplaced] = s;
+			}
+			if (nplaced == nkeys) {
+				break;
+			}
+			while (nplaced--) {
+				slots[placed[nplaced]] = (struct wsk_symbol){ 0 };
+			}
+		}
+		if (d == MAX_DISPLACEMENT) {
+			fprintf(stderr, "Unable to build perfect hash for symbol table\n");
+			goto out;
+		}
+		disp[b] = d;
+	}
+
+	*tab = (struct wsk_symtab){
+		.bucket_mask = bucket_mask,
+		.slot_mask = slot_mask,
+		.disp = disp,
+		.slots = slots,
+		.count = len,
+	};
+	disp = NULL;
+	slots = NULL;
+	ret = 0;
+
+out:
+	free(disp);
+	free(slots);
+	free(order);
+	free(members);
+	free(placed);
+	free(keys);
+	return ret;
+}
+
+void symtab_finish(struct wsk_symtab *tab) {
+	for (size_t i = 0; i <= tab->slot_mask && tab->slots; ++i) {
+		free((char *)tab->slots[i].label);
+	}
+	free((uint32_t *)tab->disp);
+	free((struct wsk_symbol *)tab->slots);
+	memset(tab, 0, sizeof(*tab));
+}
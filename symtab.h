@@ -0,0 +1,48 @@
+#ifndef _WSK_SYMTAB_H
+#define _WSK_SYMTAB_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct wsk_symbol {
+	uint32_t sym;
+	const char *label;
+};
+
+/*
+ * Perfect hash from keysym to label (hash and displace). A lookup is two
+ * table reads and one compare; empty slots have a NULL label.
+ */
+struct wsk_symtab {
+	uint32_t bucket_mask, slot_mask;
+	const uint32_t *disp;
+	const struct wsk_symbol *slots;
+	size_t count;
+};
+
+static inline uint32_t symtab_mix(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+static inline const char *symtab_lookup(const struct wsk_symtab *tab,
+		const uint32_t sym) {
+	const uint32_t d = tab->disp[(symtab_mix(sym) >> 16) & tab->bucket_mask];
+	const struct wsk_symbol *slot =
+		&tab->slots[symtab_mix(sym ^ d) & tab->slot_mask];
+	return slot->sym == sym ? slot->label : NULL;
+}
+
+/* Parses "keysym label" lines; later entries replace earlier ones. */
+int symtab_parse(FILE *f, const char *path,
+		struct wsk_symbol **syms, size_t *len);
+/* Builds a table over syms; the table takes ownership of the labels. */
+int symtab_build(struct wsk_symtab *tab,
+		const struct wsk_symbol *syms, size_t len);
+void symtab_finish(struct wsk_symtab *tab);
+
+#endif
@@ -0,0 +1,8 @@
+#include "trace.h"
+
+/* The semaphores sys/sdt.h points every probe at; only built with the
+ * tracepoints option */
+#define WSK_SEMAPHORE(name) \
+	volatile unsigned short wshowkeys_##name##_semaphore \
+		__attribute__((section(".probes")));
+WSK_PROBES(WSK_SEMAPHORE)
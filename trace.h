@@ -0,0 +1,70 @@
+#ifndef _WSK_TRACE_H
+#define _WSK_TRACE_H
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Static tracepoints for perf and bpftrace, built with the tracepoints option,
+ * all under the "wshowkeys" provider. Each probe has an SDT semaphore that
+ * tracers raise while attached; until then a probe costs a load and a branch,
+ * and its arguments (trace_now() included) are not evaluated. Without the
+ * option the macros expand to nothing. Times are CLOCK_MONOTONIC nanoseconds.
+ */
+#ifdef WSK_TRACE
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define WSK_PROBES(X) \
+	X(input) \
+	X(key_append) \
+	X(key_fold) \
+	X(trim) \
+	X(render_start) \
+	X(render_end) \
+	X(commit) \
+	X(buffer_busy) \
+	X(buffer_acquire) \
+	X(buffer_release) \
+	X(devmgr_open) \
+	X(devmgr_opened)
+
+#define WSK_SEMAPHORE(name) \
+	extern volatile unsigned short wshowkeys_##name##_semaphore;
+WSK_PROBES(WSK_SEMAPHORE)
+#undef WSK_SEMAPHORE
+
+#define WSK_TRACED(name) __builtin_expect(wshowkeys_##name##_semaphore, 0)
+#define WSK_TRACE1(name, a) do { \
+	if (WSK_TRACED(name)) { \
+		DTRACE_PROBE1(wshowkeys, name, a); \
+	} \
+} while (0)
+#define WSK_TRACE2(name, a, b) do { \
+	if (WSK_TRACED(name)) { \
+		DTRACE_PROBE2(wshowkeys, name, a, b); \
+	} \
+} while (0)
+#define WSK_TRACE3(name, a, b, c) do { \
+	if (WSK_TRACED(name)) { \
+		DTRACE_PROBE3(wshowkeys, name, a, b, c); \
+	} \
+} while (0)
+#define WSK_TRACE4(name, a, b, c, d) do { \
+	if (WSK_TRACED(name)) { \
+		DTRACE_PROBE4(wshowkeys, name, a, b, c, d); \
+	} \
+} while (0)
+
+static inline uint64_t trace_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#else
+#define WSK_TRACE1(name, a)
+#define WSK_TRACE2(name, a, b)
+#define WSK_TRACE3(name, a, b, c)
+#define WSK_TRACE4(name, a, b, c, d)
+#endif
+
+#endif